@@ -1,6 +1,27 @@
+// mmap flags such as MAP_ANONYMOUS are hidden by -std=c99 on glibc
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
 #include <math.h>
+#include <time.h>
+
+#if defined(__x86_64__) && defined(__unix__)
+    #include <sys/mman.h>
+    #define LJIT_X86_64
+#endif
+
+#ifdef __unix__
+    #include <dlfcn.h>
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    #include <immintrin.h>
+    #define LVEC_X86
+#endif
 
 #include <editline/readline.h>
 #ifndef __APPLE__
@@ -14,19 +35,21 @@
     strcpy(a, b);               \
 
 enum lval_type {
-    LVAL_ERR, LVAL_NUM, LVAL_SYM,
-    LVAL_FUN, LVAL_BOOL, LVAL_SEXP, LVAL_QEXP
+    LVAL_ERR, LVAL_NUM, LVAL_BIG, LVAL_SYM,
+    LVAL_FUN, LVAL_BOOL, LVAL_SEXP, LVAL_QEXP, LVAL_VEC
 };
 
 char* lval_type_name(enum lval_type t) {
     switch (t) {
         case LVAL_ERR:  return "Error";
         case LVAL_NUM:  return "Number";
+        case LVAL_BIG:  return "Number";
         case LVAL_SYM:  return "Symbol";
         case LVAL_FUN:  return "Function";
         case LVAL_BOOL: return "Boolean";
         case LVAL_SEXP: return "Sexp";
         case LVAL_QEXP: return "Qexp";
+        case LVAL_VEC:  return "Vector";
     }
 }
 
@@ -34,17 +57,45 @@ enum lval_fun_type { LVAL_FUN_BUILTIN, LVAL_FUN_LAMBDA };
 
 struct lval;
 struct lenv;
+struct lcode;
+struct ljit;
+struct lcells;
 
 typedef struct lval* (*lfunc)(struct lenv*, struct lval*);
 
+// An integer too big for a long, as a sign and a magnitude in base 2^32
+// digits, least significant first. Also used to view a fixnum as one
+struct lbig {
+    int neg;
+    int count;
+    uint32_t* digits;
+};
+
+// Values are shared by reference count. lval_copy hands out another
+// reference and lval_del drops one, so anything that mutates a value
+// must first take sole ownership of it with lval_own
 struct lval {
     enum lval_type type;
+    int refs;
     union {
         char* err;
         long num;
-        char* sym;
+        struct lbig big;
+        struct { // symbol
+            int sym;
+            // Lexical address (frames up, slot in frame) of a lambda
+            // parameter, filled in when the lambda is made. depth is -1
+            // for anything that is not a parameter
+            short depth;
+            short slot;
+            // Inline cache for globals: the root env slot the symbol was
+            // found in, valid while stamp matches lenv_version
+            int cache;
+            unsigned stamp;
+        };
         struct { // functions
             enum lval_fun_type fun_type;
+            unsigned serial; // lambdas: what call sites know it by, or 0
             union {
                 struct { //builtin
                     char* name;
@@ -54,13 +105,23 @@ struct lval {
                     struct lenv* env;
                     struct lval* args;
                     struct lval* body;
+                    struct lval* folded; // body with calls folded, or NULL
+                    struct lcode* code; // body bytecode, or NULL
+                    struct ljit* jit; // call count and native code
                 };
             };
         };
         int flag;
         struct { // sexp / qexp
             int count;
+            int site; // call site state when evaluated, see lsite
+            struct lcells* buf; // where the cells live, or NULL
             struct lval** cell;
+            unsigned target; // the op or lambda serial the site expects
+        };
+        struct { // vector
+            int length;
+            int64_t* items;
         };
     };
 };
@@ -68,89 +129,492 @@ struct lval* lval_err(char* msg, ...);
 
 void lval_del(struct lval*);
 struct lval* lval_copy(struct lval*);
+struct lval* lgc_promote(struct lval*);
+
+// Slab allocator. Every lval comes from a dedicated pool, while cell
+// arrays and env tables come from power-of-two size classes. Freed
+// blocks go back on their pool's free list and are never returned to
+// malloc, so steady-state evaluation does no malloc traffic at all.
+#define LMEM_CLASSES 13 // 8 bytes up to 32k
+#define LMEM_CHUNK (64 * 1024)
+
+struct lmem_pool {
+    size_t size;
+    size_t link; // offset of the free list pointer within a free block
+    void* free;
+    long live;
+    long peak;
+    int nchunks;
+    char** chunks;
+};
+
+// Free lvals keep refs == 0 so the collector can tell them apart
+struct lmem_pool lmem_lvals = {
+    sizeof(struct lval), offsetof(struct lval, cell), NULL, 0, 0, 0, NULL
+};
+struct lmem_pool lmem_classes[LMEM_CLASSES];
+long lmem_chunks = 0;
+long lmem_large = 0;
+
+#define LMEM_NEXT(p, x) (*(void**) ((char*) (x) + (p)->link))
+
+void* lmem_pool_alloc(struct lmem_pool* p) {
+    if (p->free == NULL) {
+        int n = LMEM_CHUNK / p->size;
+        char* chunk = calloc(n, p->size);
+        lmem_chunks++;
+        p->chunks = realloc(p->chunks, sizeof(char*) * (p->nchunks + 1));
+        p->chunks[p->nchunks++] = chunk;
+        for (int i = n - 1; i >= 0; i--) {
+            void* slot = chunk + i * p->size;
+            LMEM_NEXT(p, slot) = p->free;
+            p->free = slot;
+        }
+    }
+    void* slot = p->free;
+    p->free = LMEM_NEXT(p, slot);
+    p->live++;
+    if (p->live > p->peak) p->peak = p->live;
+    return slot;
+}
+
+void lmem_pool_free(struct lmem_pool* p, void* x) {
+    LMEM_NEXT(p, x) = p->free;
+    p->free = x;
+    p->live--;
+}
+
+int lmem_class(size_t size) {
+    int c = 0;
+    while (((size_t) 8 << c) < size) c++;
+    return c;
+}
+
+void* lmem_alloc(size_t size) {
+    if (size == 0) return NULL;
+    int c = lmem_class(size);
+    if (c >= LMEM_CLASSES) {
+        lmem_large++;
+        return malloc(size);
+    }
+    lmem_classes[c].size = (size_t) 8 << c;
+    return lmem_pool_alloc(&lmem_classes[c]);
+}
+
+void lmem_free(void* x, size_t size) {
+    if (x == NULL) return;
+    int c = lmem_class(size);
+    if (c >= LMEM_CLASSES) {
+        free(x);
+    } else {
+        lmem_pool_free(&lmem_classes[c], x);
+    }
+}
+
+// Only moves the block when the size crosses into another class
+void* lmem_realloc(void* x, size_t old_size, size_t new_size) {
+    if (x && old_size && new_size) {
+        int old_c = lmem_class(old_size);
+        int new_c = lmem_class(new_size);
+        if (old_c == new_c && new_c < LMEM_CLASSES) return x;
+        if (old_c >= LMEM_CLASSES && new_c >= LMEM_CLASSES) {
+            return realloc(x, new_size);
+        }
+    }
+    void* y = lmem_alloc(new_size);
+    if (x && y) memcpy(y, x, old_size < new_size ? old_size : new_size);
+    lmem_free(x, old_size);
+    return y;
+}
+
+// Young generation. New lvals are bump allocated from the nursery, and
+// slots freed by refcounting are recycled through its own free list.
+// Values stored in the root env are promoted (copied) into the pool,
+// the old space, so the REPL can reset the whole nursery between
+// expressions once nothing young is left alive.
+struct lgc_nursery {
+    struct lval* start;
+    struct lval* next;
+    struct lval* end;
+    struct lval* free;
+    long size;
+    long minors;
+    long promoted;
+    double pause;
+    double total_pause;
+};
+
+struct lgc_nursery lgc_young = { NULL, NULL, NULL, NULL, 4096, 0, 0, 0, 0 };
+int lgc_tenure = 0; // allocate straight into the old space
+
+#define LGC_YOUNG(v) ((v) >= lgc_young.start && (v) < lgc_young.end)
+
+void lgc_init_nursery(long size) {
+    lgc_young.size = size;
+    lgc_young.start = calloc(size, sizeof(struct lval));
+    lgc_young.next = lgc_young.start;
+    lgc_young.end = lgc_young.start + size;
+}
+
+long lval_allocs = 0;
+
+struct lval* lval_new(enum lval_type type) {
+    struct lval* v;
+    if (lgc_tenure) {
+        v = lmem_pool_alloc(&lmem_lvals);
+    } else if (lgc_young.next < lgc_young.end) {
+        v = lgc_young.next++;
+    } else if (lgc_young.free) {
+        v = lgc_young.free;
+        lgc_young.free = LMEM_NEXT(&lmem_lvals, v);
+    } else {
+        v = lmem_pool_alloc(&lmem_lvals);
+    }
+    v->type = type;
+    v->refs = 1;
+    lval_allocs++;
+    return v;
+}
+
+// Every symbol name is interned once, so symbols can be compared and
+// copied as small integer IDs instead of heap strings
+struct lsymtab {
+    int count;
+    int cap;
+    char** names;
+    int* slots; // open-addressed, holds id + 1 (0 is empty)
+    int* locals; // how many local frames bind each symbol
+    char* folded; // whether a folded lambda body relies on the symbol
+};
+
+struct lsymtab lsyms = { 0, 0, NULL, NULL, NULL, NULL };
 
+unsigned long lsym_hash(char* name) {
+    unsigned long h = 5381;
+    while (*name) h = h * 33 + (unsigned char) *name++;
+    return h;
+}
+
+void lsym_grow(void) {
+    int cap = lsyms.cap ? lsyms.cap * 2 : 64;
+    free(lsyms.slots);
+    lsyms.slots = calloc(cap, sizeof(int));
+    lsyms.names = realloc(lsyms.names, sizeof(char*) * cap);
+    lsyms.locals = realloc(lsyms.locals, sizeof(int) * cap);
+    lsyms.folded = realloc(lsyms.folded, cap);
+    for (int id = lsyms.cap; id < cap; id++) {
+        lsyms.locals[id] = 0;
+        lsyms.folded[id] = 0;
+    }
+    lsyms.cap = cap;
+    for (int id = 0; id < lsyms.count; id++) {
+        unsigned long i = lsym_hash(lsyms.names[id]) & (cap - 1);
+        while (lsyms.slots[i]) i = (i + 1) & (cap - 1);
+        lsyms.slots[i] = id + 1;
+    }
+}
+
+int lsym_intern(char* name) {
+    // keep the table at most half full
+    if (lsyms.count * 2 >= lsyms.cap) lsym_grow();
+
+    unsigned long i = lsym_hash(name) & (lsyms.cap - 1);
+    while (lsyms.slots[i]) {
+        int id = lsyms.slots[i] - 1;
+        if (strcmp(lsyms.names[id], name) == 0) return id;
+        i = (i + 1) & (lsyms.cap - 1);
+    }
+
+    int id = lsyms.count++;
+    STR_COPY(lsyms.names[id], name);
+    lsyms.slots[i] = id + 1;
+    return id;
+}
+
+char* lsym_name(int id) {
+    return lsyms.names[id];
+}
+
+// Symbols the evaluator checks for by identity
+int lsym_amp;
+int lsym_lambda;
+int lsym_if;
+
+// Local frames are immutable once filled in, so lambdas share them by
+// reference count, like lcells. Only a call's own frame is changed
+// after it is made, by ltail_run relinking its parent, and lenv_own
+// gives a private copy to anything else that needs one
 struct lenv {
+    int refs;
     struct lenv* parent;
     int count;
-    char** syms;
+    int* syms;
     struct lval** vals;
+    // The root env is an open-addressed hash table of cap slots with
+    // empty slots marked -1. Local frames are small and stay linear (cap 0)
+    // and are allocated in one block with their slots, see lenv_frame
+    int cap;
 };
 
+#define LENV_HASH(sym, cap) (((unsigned) (sym) * 2654435761u) & ((cap) - 1))
+
+// The root env, and a version bumped whenever a symbol is added to it
+// and slots may have moved. Inline caches on symbol nodes check it
+struct lenv* lenv_globals = NULL;
+unsigned lenv_version = 1;
+long lenv_cache_hits = 0;
+long lenv_cache_misses = 0;
+long lfold_count = 0;
+long lfold_shadowed = 0; // live local bindings of lsyms.folded names
+
+// Keep lsyms.locals in step as a local frame gains or loses its bindings
+void lenv_count_locals(struct lenv* e, int delta) {
+    if (e->cap) return;
+    for (int i = 0; i < e->count; i++) {
+        lsyms.locals[e->syms[i]] += delta;
+        if (lsyms.folded[e->syms[i]]) lfold_shadowed += delta;
+    }
+}
+
+size_t lenv_frame_size(int n) {
+    return sizeof(struct lenv) + (sizeof(struct lval*) + sizeof(int)) * n;
+}
+
+// A local frame of n bindings for the caller to fill in by index, in
+// parameter order, which is also the order lexical addresses count in
+struct lenv* lenv_frame(int n) {
+    struct lenv* e = lmem_alloc(lenv_frame_size(n));
+    e->refs = 1;
+    e->parent = NULL;
+    e->count = n;
+    e->vals = (struct lval**) (e + 1);
+    e->syms = (int*) (e->vals + n);
+    e->cap = 0;
+    return e;
+}
+
+struct lenv* lenv_copy(struct lenv* e);
+
+// New lambdas all share one empty frame
+struct lenv* lenv_empty = NULL;
+
 struct lenv* lenv_new(void) {
-    struct lenv* e = malloc(sizeof(struct lenv));
+    if (lenv_empty == NULL) lenv_empty = lenv_frame(0);
+    return lenv_copy(lenv_empty);
+}
+
+struct lenv* lenv_new_root(void) {
+    struct lenv* e = lmem_alloc(sizeof(struct lenv));
+    e->refs = 1;
     e->parent = NULL;
     e->count = 0;
-    e->syms = NULL;
-    e->vals = NULL;
+    e->cap = 64;
+    e->syms = lmem_alloc(sizeof(int) * e->cap);
+    e->vals = lmem_alloc(sizeof(struct lval*) * e->cap);
+    for (int i = 0; i < e->cap; i++) e->syms[i] = -1;
+    lenv_globals = e;
     return e;
 }
 
+// Frees e's own storage without touching the values it binds
+void lenv_free(struct lenv* e) {
+    if (e->cap) {
+        lmem_free(e->syms, sizeof(int) * e->cap);
+        lmem_free(e->vals, sizeof(struct lval*) * e->cap);
+        lmem_free(e, sizeof(struct lenv));
+    } else {
+        lmem_free(e, lenv_frame_size(e->count));
+    }
+}
+
 void lenv_del(struct lenv* e) {
-    for (int i = 0; i< e->count; i++) {
-        free(e->syms[i]);
-        lval_del(e->vals[i]);
+    if (--e->refs > 0) return;
+    lenv_count_locals(e, -1);
+    int n = e->cap ? e->cap : e->count;
+    for (int i = 0; i < n; i++) {
+        if (e->syms[i] >= 0) lval_del(e->vals[i]);
     }
-    free(e->syms);
-    free(e->vals);
-    free(e);
+    lenv_free(e);
 }
 
-struct lval* lenv_get(struct lenv* e, char* sym) {
-    for (int i = 0; i < e->count; i++) {
-        if (strcmp(e->syms[i], sym) == 0) {
+// Slot holding sym in a hashed env, or the empty slot it would go in
+int lenv_slot(struct lenv* e, int sym) {
+    unsigned i = LENV_HASH(sym, e->cap);
+    while (e->syms[i] >= 0 && e->syms[i] != sym) {
+        i = (i + 1) & (e->cap - 1);
+    }
+    return i;
+}
+
+void lenv_grow(struct lenv* e) {
+    int old_cap = e->cap;
+    int* old_syms = e->syms;
+    struct lval** old_vals = e->vals;
+
+    e->cap *= 2;
+    e->syms = lmem_alloc(sizeof(int) * e->cap);
+    e->vals = lmem_alloc(sizeof(struct lval*) * e->cap);
+    for (int i = 0; i < e->cap; i++) e->syms[i] = -1;
+
+    for (int i = 0; i < old_cap; i++) {
+        if (old_syms[i] < 0) continue;
+        int j = lenv_slot(e, old_syms[i]);
+        e->syms[j] = old_syms[i];
+        e->vals[j] = old_vals[i];
+    }
+    lmem_free(old_syms, sizeof(int) * old_cap);
+    lmem_free(old_vals, sizeof(struct lval*) * old_cap);
+}
+
+struct lval* lenv_get(struct lenv* e, int sym) {
+    if (e->cap) {
+        int i = lenv_slot(e, sym);
+        if (e->syms[i] == sym) {
             return lval_copy(e->vals[i]);
         }
+    } else {
+        // A name bound twice in a frame means its last binding, as it
+        // did when each argument was put in turn
+        for (int i = e->count - 1; i >= 0; i--) {
+            if (e->syms[i] == sym) {
+                return lval_copy(e->vals[i]);
+            }
+        }
     }
     if (e->parent) {
         return lenv_get(e->parent, sym);
     }
-    return lval_err("Unbound symbol '%s'", sym);
+    return lval_err("Unbound symbol '%s'", lsym_name(sym));
 }
 
-void lenv_put(struct lenv* e, char* sym, struct lval* v) {
-    for (int i = 0; i < e->count; i++) {
-        if (strcmp(e->syms[i], sym) == 0) {
+// Look up a symbol node by its lexical address. Scope is dynamic, so the
+// address is only a guess: it is used when the frame it names really
+// binds the symbol there and no nearer frame binds it too, and anything
+// else goes through lenv_get
+struct lval* lenv_get_sym(struct lenv* e, struct lval* s) {
+    if (s->depth >= 0) {
+        struct lenv* f = e;
+        int d;
+        for (d = 0; d < s->depth && f && !f->cap; d++) {
+            for (int i = f->count - 1; i >= 0; i--) {
+                if (f->syms[i] == s->sym) return lval_copy(f->vals[i]);
+            }
+            f = f->parent;
+        }
+        if (d == s->depth && f && !f->cap && s->slot < f->count
+                && f->syms[s->slot] == s->sym) {
+            return lval_copy(f->vals[s->slot]);
+        }
+    }
+
+    // With no local frame binding the symbol it can only be a global
+    if (lsyms.locals[s->sym] == 0 && lenv_globals) {
+        if (s->stamp == lenv_version) {
+            lenv_cache_hits++;
+            return lval_copy(lenv_globals->vals[s->cache]);
+        }
+        lenv_cache_misses++;
+        int i = lenv_slot(lenv_globals, s->sym);
+        if (lenv_globals->syms[i] == s->sym) {
+            s->cache = i;
+            s->stamp = lenv_version;
+            return lval_copy(lenv_globals->vals[i]);
+        }
+    }
+    return lenv_get(e, s->sym);
+}
+
+void lenv_put(struct lenv* e, int sym, struct lval* v) {
+    if (e->cap) {
+        int i = lenv_slot(e, sym);
+        if (e->syms[i] == sym) {
             lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
+            e->vals[i] = lgc_promote(v);
             return;
         }
+        // keep the load factor under 3/4
+        if ((e->count + 1) * 4 > e->cap * 3) {
+            lenv_grow(e);
+            i = lenv_slot(e, sym);
+        }
+        lenv_version++;
+        e->count += 1;
+        e->syms[i] = sym;
+        e->vals[i] = lgc_promote(v);
+        return;
     }
-    e->count += 1;
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
-    e->vals = realloc(e->vals, sizeof(struct lval*) * e->count);
 
-    STR_COPY(e->syms[e->count - 1], sym);
-    e->vals[e->count - 1] = lval_copy(v);
+    // Local frames get all their bindings when they are made, so they
+    // can only be rebound, and by whoever owns them (see lenv_own)
+    for (int i = e->count - 1; i >= 0; i--) {
+        if (e->syms[i] == sym) {
+            lval_del(e->vals[i]);
+            e->vals[i] = lval_copy(v);
+            return;
+        }
+    }
 }
 
-void lenv_def(struct lenv* e, char* sym, struct lval* v) {
+void lenv_def(struct lenv* e, int sym, struct lval* v) {
     while (e->parent) e = e->parent;
     lenv_put(e, sym, v);
 }
 
 struct lenv* lenv_copy(struct lenv* e) {
-    struct lenv* n = malloc(sizeof(struct lenv));
+    e->refs++;
+    return e;
+}
+
+// Copy-on-write: returns e itself when no other lambda shares it
+struct lenv* lenv_own(struct lenv* e) {
+    if (e->refs == 1) return e;
+    struct lenv* n = lenv_frame(e->count);
     n->parent = e->parent;
-    n->count = e->count;
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(struct lval*) * n->count);
     for (int i = 0; i < e->count; i++) {
-        STR_COPY(n->syms[i], e->syms[i]);
+        n->syms[i] = e->syms[i];
         n->vals[i] = lval_copy(e->vals[i]);
     }
+    lenv_count_locals(n, 1);
+    e->refs--;
     return n;
 }
 
+// Booleans and small numbers are preallocated, shared immediates, so
+// arithmetic and comparisons producing them never touch the heap.
+// Larger numbers fall back to ordinary pool allocated lvals.
+#define LVAL_SMALL_MIN -256
+#define LVAL_SMALL_MAX 1023
+#define LVAL_SMALL_COUNT (LVAL_SMALL_MAX - LVAL_SMALL_MIN + 1)
+
+struct lval lval_immediates[LVAL_SMALL_COUNT + 2];
+
+#define LVAL_IMMEDIATE(v) \
+    ((v) >= lval_immediates && (v) < lval_immediates + LVAL_SMALL_COUNT + 2)
+
+void lval_init_immediates(void) {
+    for (int i = 0; i < LVAL_SMALL_COUNT; i++) {
+        lval_immediates[i].type = LVAL_NUM;
+        lval_immediates[i].refs = 1;
+        lval_immediates[i].num = LVAL_SMALL_MIN + i;
+    }
+    for (int i = 0; i < 2; i++) {
+        lval_immediates[LVAL_SMALL_COUNT + i].type = LVAL_BOOL;
+        lval_immediates[LVAL_SMALL_COUNT + i].refs = 1;
+        lval_immediates[LVAL_SMALL_COUNT + i].flag = i;
+    }
+}
+
 struct lval* lval_num(long x) {
-    struct lval* v = malloc(sizeof(struct lval));
-    v->type = LVAL_NUM;
+    if (x >= LVAL_SMALL_MIN && x <= LVAL_SMALL_MAX) {
+        return lval_copy(&lval_immediates[x - LVAL_SMALL_MIN]);
+    }
+    struct lval* v = lval_new(LVAL_NUM);
     v->num = x;
     return v;
 }
 
 struct lval* lval_err(char* msg, ...) {
-    struct lval* v = malloc(sizeof(struct lval));
-    v->type = LVAL_ERR;
+    struct lval* v = lval_new(LVAL_ERR);
 
     va_list va;
     va_start(va, msg);
@@ -160,85 +624,627 @@ struct lval* lval_err(char* msg, ...) {
     return v;
 }
 
-struct lval* lval_sym(char* s) {
-    struct lval* v = malloc(sizeof(struct lval));
-    v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
+// Bignums are kept normalized: no leading zero digits, and any result
+// that fits a long comes back as a plain LVAL_NUM. So every integer has
+// one representation, and fixnum code never meets a small bignum.
+#define LBIG_KARATSUBA 32 // digits below which schoolbook multiply wins
+#define LBIG_MAX_BITS (1L << 25) // largest power ^ will build
+
+struct lbig lbig_view(struct lval* v, uint32_t buf[2]) {
+    if (v->type == LVAL_BIG) return v->big;
+    unsigned long long m = v->num < 0
+        ? -(unsigned long long) v->num : (unsigned long long) v->num;
+    buf[0] = (uint32_t) m;
+    buf[1] = (uint32_t) (m >> 32);
+    struct lbig b = { v->num < 0, buf[1] ? 2 : buf[0] ? 1 : 0, buf };
+    return b;
+}
+
+uint32_t* lbig_alloc(int count) {
+    uint32_t* digits = lmem_alloc(sizeof(uint32_t) * count);
+    if (count) memset(digits, 0, sizeof(uint32_t) * count);
+    return digits;
+}
+
+void lbig_free(uint32_t* digits, int count) {
+    lmem_free(digits, sizeof(uint32_t) * count);
+}
+
+// Takes ownership of count digits and normalizes them into a number
+struct lval* lbig_make(int neg, uint32_t* digits, int count) {
+    int n = count;
+    while (n > 0 && digits[n - 1] == 0) n--;
+    if (n <= 2) {
+        unsigned long long m = n > 0 ? digits[0] : 0;
+        if (n > 1) m |= (unsigned long long) digits[1] << 32;
+        if (m <= (unsigned long long) LONG_MAX + neg) {
+            lbig_free(digits, count);
+            return lval_num(neg && m ? -(long) (m - 1) - 1 : (long) m);
+        }
+    }
+    struct lval* v = lval_new(LVAL_BIG);
+    v->big.neg = neg;
+    v->big.count = n;
+    v->big.digits = lmem_realloc(digits,
+        sizeof(uint32_t) * count, sizeof(uint32_t) * n);
+    return v;
+}
+
+int lbig_compare_digits(uint32_t* a, int an, uint32_t* b, int bn) {
+    if (an != bn) return an < bn ? -1 : 1;
+    for (int i = an - 1; i >= 0; i--) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// r[0..rn) += s[0..sn), for sums that fit in rn digits
+void lbig_add_digits(uint32_t* r, int rn, uint32_t* s, int sn) {
+    uint64_t carry = 0;
+    for (int i = 0; i < rn && (i < sn || carry); i++) {
+        carry += (uint64_t) r[i] + (i < sn ? s[i] : 0);
+        r[i] = (uint32_t) carry;
+        carry >>= 32;
+    }
+}
+
+// r[0..rn) -= s[0..sn), for differences that aren't negative
+void lbig_sub_digits(uint32_t* r, int rn, uint32_t* s, int sn) {
+    uint64_t borrow = 0;
+    for (int i = 0; i < rn && (i < sn || borrow); i++) {
+        uint64_t d = (uint64_t) r[i] - (i < sn ? s[i] : 0) - borrow;
+        r[i] = (uint32_t) d;
+        borrow = d >> 63;
+    }
+}
+
+// r[0..an+bn) = a * b, where r starts out zeroed
+void lbig_mul_digits(uint32_t* r, uint32_t* a, int an, uint32_t* b, int bn) {
+    if (an < bn) {
+        uint32_t* t = a; a = b; b = t;
+        int tn = an; an = bn; bn = tn;
+    }
+
+    if (bn < LBIG_KARATSUBA) {
+        for (int i = 0; i < bn; i++) {
+            uint64_t carry = 0;
+            for (int j = 0; j < an; j++) {
+                carry += (uint64_t) b[i] * a[j] + r[i + j];
+                r[i + j] = (uint32_t) carry;
+                carry >>= 32;
+            }
+            r[i + an] = (uint32_t) carry;
+        }
+        return;
+    }
+
+    int m = an / 2;
+    if (bn <= m) {
+        // Too lopsided to split both, so a0 b + a1 b B^m
+        int tn = an - m + bn;
+        uint32_t* t = lbig_alloc(tn);
+        lbig_mul_digits(r, a, m, b, bn);
+        lbig_mul_digits(t, a + m, an - m, b, bn);
+        lbig_add_digits(r + m, an + bn - m, t, tn);
+        lbig_free(t, tn);
+        return;
+    }
+
+    // Karatsuba: with a = a1 B^m + a0 and b = b1 B^m + b0, three half
+    // size products give a b = z2 B^2m + z1 B^m + z0, where z0 = a0 b0,
+    // z2 = a1 b1 and z1 = (a0 + a1)(b0 + b1) - z0 - z2
+    int an1 = an - m, bn1 = bn - m;
+    int sn = an1 + 1, tn = (bn1 > m ? bn1 : m) + 1, zn = sn + tn;
+    uint32_t* s = lbig_alloc(sn);
+    uint32_t* t = lbig_alloc(tn);
+    uint32_t* z1 = lbig_alloc(zn);
+    memcpy(s, a, sizeof(uint32_t) * m);
+    lbig_add_digits(s, sn, a + m, an1);
+    memcpy(t, b, sizeof(uint32_t) * m);
+    lbig_add_digits(t, tn, b + m, bn1);
+
+    lbig_mul_digits(r, a, m, b, m);
+    lbig_mul_digits(r + 2 * m, a + m, an1, b + m, bn1);
+    lbig_mul_digits(z1, s, sn, t, tn);
+    lbig_sub_digits(z1, zn, r, 2 * m);
+    lbig_sub_digits(z1, zn, r + 2 * m, an1 + bn1);
+    lbig_add_digits(r + m, an + bn - m, z1, zn);
+
+    lbig_free(s, sn);
+    lbig_free(t, tn);
+    lbig_free(z1, zn);
+}
+
+// q = u / v and r = u % v for un >= vn > 0 and v normalized, with q of
+// un - vn + 1 digits and r of vn. This is Knuth's Algorithm D
+void lbig_div_digits(uint32_t* q, uint32_t* r,
+        uint32_t* u, int un, uint32_t* v, int vn) {
+    if (vn == 1) {
+        uint64_t rem = 0;
+        for (int j = un - 1; j >= 0; j--) {
+            rem = rem << 32 | u[j];
+            q[j] = (uint32_t) (rem / v[0]);
+            rem %= v[0];
+        }
+        r[0] = (uint32_t) rem;
+        return;
+    }
+
+    // Shift v's top bit up, so each quotient digit guess is close
+    int s = 0;
+    while (!((v[vn - 1] << s) & 0x80000000u)) s++;
+    uint32_t* vs = lbig_alloc(vn);
+    uint32_t* us = lbig_alloc(un + 1);
+    for (int i = vn - 1; i > 0; i--) {
+        vs[i] = v[i] << s | (uint32_t) ((uint64_t) v[i - 1] >> (32 - s));
+    }
+    vs[0] = v[0] << s;
+    us[un] = (uint32_t) ((uint64_t) u[un - 1] >> (32 - s));
+    for (int i = un - 1; i > 0; i--) {
+        us[i] = u[i] << s | (uint32_t) ((uint64_t) u[i - 1] >> (32 - s));
+    }
+    us[0] = u[0] << s;
+
+    for (int j = un - vn; j >= 0; j--) {
+        uint64_t top = (uint64_t) us[j + vn] << 32 | us[j + vn - 1];
+        uint64_t qhat = top / vs[vn - 1];
+        uint64_t rhat = top % vs[vn - 1];
+        while (qhat >> 32
+                || qhat * vs[vn - 2] > (rhat << 32 | us[j + vn - 2])) {
+            qhat--;
+            rhat += vs[vn - 1];
+            if (rhat >> 32) break;
+        }
+
+        // us[j..j+vn] -= qhat vs
+        uint64_t carry = 0;
+        int64_t borrow = 0;
+        for (int i = 0; i < vn; i++) {
+            uint64_t p = qhat * vs[i] + carry;
+            carry = p >> 32;
+            int64_t d = (int64_t) us[i + j] - (int64_t) (p & 0xffffffffu)
+                - borrow;
+            us[i + j] = (uint32_t) d;
+            borrow = d < 0;
+        }
+        int64_t d = (int64_t) us[j + vn] - (int64_t) carry - borrow;
+        us[j + vn] = (uint32_t) d;
+
+        q[j] = (uint32_t) qhat;
+        if (d < 0) {
+            // The guess was one too big, so add vs back
+            q[j]--;
+            carry = 0;
+            for (int i = 0; i < vn; i++) {
+                carry += (uint64_t) us[i + j] + vs[i];
+                us[i + j] = (uint32_t) carry;
+                carry >>= 32;
+            }
+            us[j + vn] += (uint32_t) carry;
+        }
+    }
+
+    for (int i = 0; i < vn; i++) {
+        r[i] = us[i] >> s | (uint32_t) ((uint64_t) us[i + 1] << (32 - s));
+    }
+    lbig_free(vs, vn);
+    lbig_free(us, un + 1);
+}
+
+// The arithmetic below takes fixnums or bignums and doesn't consume them
+
+struct lval* lbig_add(struct lval* x, struct lval* y, int negate) {
+    uint32_t xbuf[2], ybuf[2];
+    struct lbig a = lbig_view(x, xbuf);
+    struct lbig b = lbig_view(y, ybuf);
+    if (negate) b.neg = !b.neg;
+
+    // The larger magnitude gives the sign
+    if (lbig_compare_digits(a.digits, a.count, b.digits, b.count) < 0) {
+        struct lbig t = a; a = b; b = t;
+    }
+    int n = a.count + 1;
+    uint32_t* r = lbig_alloc(n);
+    lbig_add_digits(r, n, a.digits, a.count);
+    if (a.neg == b.neg) {
+        lbig_add_digits(r, n, b.digits, b.count);
+    } else {
+        lbig_sub_digits(r, n, b.digits, b.count);
+    }
+    return lbig_make(a.neg, r, n);
+}
+
+struct lval* lbig_mul(struct lval* x, struct lval* y) {
+    uint32_t xbuf[2], ybuf[2];
+    struct lbig a = lbig_view(x, xbuf);
+    struct lbig b = lbig_view(y, ybuf);
+    int n = a.count + b.count;
+    uint32_t* r = lbig_alloc(n);
+    lbig_mul_digits(r, a.digits, a.count, b.digits, b.count);
+    return lbig_make(a.neg != b.neg, r, n);
+}
+
+// Division truncates as C's does, so the remainder takes x's sign
+struct lval* lbig_div(struct lval* x, struct lval* y, int rem) {
+    uint32_t xbuf[2], ybuf[2];
+    struct lbig a = lbig_view(x, xbuf);
+    struct lbig b = lbig_view(y, ybuf);
+    if (b.count == 0) return lval_err("Division by 0");
+    if (lbig_compare_digits(a.digits, a.count, b.digits, b.count) < 0) {
+        return rem ? lval_copy(x) : lval_num(0);
+    }
+
+    int qn = a.count - b.count + 1;
+    uint32_t* q = lbig_alloc(qn);
+    uint32_t* r = lbig_alloc(b.count);
+    lbig_div_digits(q, r, a.digits, a.count, b.digits, b.count);
+    if (rem) {
+        lbig_free(q, qn);
+        return lbig_make(a.neg, r, b.count);
+    }
+    lbig_free(r, b.count);
+    return lbig_make(a.neg != b.neg, q, qn);
+}
+
+struct lval* lbig_pow(struct lval* x, struct lval* y) {
+    uint32_t xbuf[2], ybuf[2];
+    struct lbig a = lbig_view(x, xbuf);
+    struct lbig b = lbig_view(y, ybuf);
+
+    // 0, 1 and -1 stay small whatever the exponent, and only 1 and -1
+    // have integral inverses
+    if (a.count == 0) {
+        if (b.neg) return lval_err("Division by 0");
+        return lval_num(b.count == 0);
+    }
+    if (a.count == 1 && a.digits[0] == 1) {
+        int odd = b.count && (b.digits[0] & 1);
+        return lval_num(a.neg && odd ? -1 : 1);
+    }
+    if (b.neg) return lval_num(0);
+
+    long bits = 32 * (a.count - 1);
+    for (uint32_t top = a.digits[a.count - 1]; top; top >>= 1) bits++;
+    if (y->type == LVAL_BIG || y->num > LBIG_MAX_BITS / bits) {
+        return lval_err("Exponent too large");
+    }
+
+    // Repeated squaring
+    struct lval* r = lval_num(1);
+    struct lval* base = lval_copy(x);
+    for (long e = y->num; e; e >>= 1) {
+        if (e & 1) {
+            struct lval* t = lbig_mul(r, base);
+            lval_del(r);
+            r = t;
+        }
+        if (e > 1) {
+            struct lval* t = lbig_mul(base, base);
+            lval_del(base);
+            base = t;
+        }
+    }
+    lval_del(base);
+    return r;
+}
+
+int lbig_compare(struct lval* x, struct lval* y) {
+    if (x->type == LVAL_NUM && y->type == LVAL_NUM) {
+        return (x->num > y->num) - (x->num < y->num);
+    }
+    uint32_t xbuf[2], ybuf[2];
+    struct lbig a = lbig_view(x, xbuf);
+    struct lbig b = lbig_view(y, ybuf);
+    if (a.neg != b.neg) return a.neg ? -1 : 1;
+    int c = lbig_compare_digits(a.digits, a.count, b.digits, b.count);
+    return a.neg ? -c : c;
+}
+
+// Decimal digits of a bignum, in a string the caller frees
+char* lbig_string(struct lval* v) {
+    int count = v->big.count, n = count;
+    uint32_t* t = lbig_alloc(count);
+    memcpy(t, v->big.digits, sizeof(uint32_t) * count);
+
+    // Peel off nine decimal digits at a time, least significant first.
+    // 10^9 > 2^29, so that takes under two chunks per digit
+    uint32_t* chunks = lbig_alloc(2 * count + 1);
+    int nchunks = 0;
+    while (n > 0) {
+        uint64_t rem = 0;
+        for (int i = n - 1; i >= 0; i--) {
+            rem = rem << 32 | t[i];
+            t[i] = (uint32_t) (rem / 1000000000);
+            rem %= 1000000000;
+        }
+        chunks[nchunks++] = (uint32_t) rem;
+        while (n > 0 && t[n - 1] == 0) n--;
+    }
+
+    char* s = malloc(9 * nchunks + 2);
+    char* p = s;
+    if (v->big.neg) *p++ = '-';
+    p += sprintf(p, "%u", (unsigned) chunks[nchunks - 1]);
+    for (int i = nchunks - 2; i >= 0; i--) {
+        p += sprintf(p, "%09u", (unsigned) chunks[i]);
+    }
+
+    lbig_free(t, count);
+    lbig_free(chunks, 2 * count + 1);
+    return s;
+}
+
+struct lval* lbig_read(char* s) {
+    int neg = *s == '-';
+    if (neg) s++;
+    int len = strlen(s);
+    // a decimal digit is worth under 32/9 bits
+    int n = len / 9 + 1;
+    uint32_t* digits = lbig_alloc(n);
+    for (int i = 0; i < len;) {
+        uint32_t chunk = 0, scale = 1;
+        for (int k = 0; k < 9 && i < len; k++, i++) {
+            chunk = chunk * 10 + (s[i] - '0');
+            scale *= 10;
+        }
+        uint64_t carry = chunk;
+        for (int j = 0; j < n; j++) {
+            carry += (uint64_t) digits[j] * scale;
+            digits[j] = (uint32_t) carry;
+            carry >>= 32;
+        }
+    }
+    return lbig_make(neg, digits, n);
+}
+
+struct lval* lval_sym(int sym) {
+    struct lval* v = lval_new(LVAL_SYM);
+    v->sym = sym;
+    v->depth = -1;
+    v->slot = 0;
+    v->cache = 0;
+    v->stamp = 0;
     return v;
 }
 
 struct lval* lval_builtin(char* name, lfunc fn) {
-    struct lval* v = malloc(sizeof(struct lval));
-    v->type = LVAL_FUN;
+    struct lval* v = lval_new(LVAL_FUN);
     v->fun_type = LVAL_FUN_BUILTIN;
-    STR_COPY(v->name, name);
+    // names live in the symbol table, so builtins never own them
+    v->name = lsym_name(lsym_intern(name));
     v->builtin = fn;
     return v;
 }
 
-struct lval* lval_lambda(struct lval* args, struct lval* body) {
-    struct lval* v = malloc(sizeof(struct lval));
-    v->type = LVAL_FUN;
+struct lcode* lvm_compile(struct lval* body);
+struct lcode* lcode_copy(struct lcode* code);
+void lcode_del(struct lcode* code);
+
+struct ljit* ljit_new(void);
+struct ljit* ljit_copy(struct ljit* jit);
+void ljit_del(struct ljit* jit);
+void ljit_end_reruns(int depth);
+
+// Lambdas whose bailed native code is being rerun, see ljit_call
+struct ljit* ljit_reruns = NULL;
+
+enum ljit_mode { LJIT_OFF, LJIT_ON, LJIT_STATS };
+
+enum ljit_mode ljit_mode = LJIT_OFF;
+
+enum lvm_engine { LVM_ENGINE_TREE, LVM_ENGINE_VM };
+
+enum lvm_engine lvm_engine = LVM_ENGINE_TREE;
+
+// Lambdas are numbered as they are made, so that a call site can tell
+// whether it is calling the same one again without keeping it alive.
+// Ones taking & get 0, which no site expects
+unsigned lval_serial = 0;
+
+struct lval* lval_lambda(struct lval* args, struct lval* body,
+        struct lval* folded) {
+    struct lval* v = lval_new(LVAL_FUN);
     v->fun_type = LVAL_FUN_LAMBDA;
+    if (++lval_serial == 0) lval_serial = 1;
+    v->serial = lval_serial;
+    for (int i = 0; i < args->count; i++) {
+        if (args->cell[i]->sym == lsym_amp) v->serial = 0;
+    }
     v->env = lenv_new();
     v->args = args;
     v->body = body;
+    v->folded = folded;
+    v->code = lvm_engine == LVM_ENGINE_VM
+        ? lvm_compile(folded ? folded : body) : NULL;
+    v->jit = ljit_mode != LJIT_OFF ? ljit_new() : NULL;
     return v;
 }
 
 struct lval* lval_bool(int flag) {
-    struct lval* v = malloc(sizeof(struct lval));
-    v->type = LVAL_BOOL;
-    v->flag = flag == 0 ? 0 : 1;
-    return v;
+    return lval_copy(&lval_immediates[LVAL_SMALL_COUNT + (flag != 0)]);
 }
 
 struct lval* lval_sexp(void) {
-    struct lval* v = malloc(sizeof(struct lval));
-    v->type = LVAL_SEXP;
+    struct lval* v = lval_new(LVAL_SEXP);
     v->count = 0;
+    v->site = 0;
+    v->buf = NULL;
     v->cell = NULL;
+    v->target = 0;
     return v;
 }
 struct lval* lval_qexp(void) {
-    struct lval* v = malloc(sizeof(struct lval));
-    v->type = LVAL_QEXP;
+    struct lval* v = lval_new(LVAL_QEXP);
     v->count = 0;
+    v->site = 0;
+    v->buf = NULL;
     v->cell = NULL;
+    v->target = 0;
+    return v;
+}
+
+// Cells live in refcounted buffers that lists can share. A list is a
+// view of count cells starting at cell, and its buffer holds a reference
+// to every value in the claimed slots [lo, hi). A view ending at hi may
+// claim the free slots after it even while the buffer is shared, as no
+// other view can see them, and likewise one starting at lo the slots
+// before it. So cons and join extend a list in place rather than copying
+// it, and buffers grow geometrically, making both amortized O(1).
+struct lcells {
+    int refs;
+    int cap;
+    int lo;
+    int hi;
+    struct lval* slots[];
+};
+
+size_t lcells_size(int cap) {
+    return sizeof(struct lcells) + sizeof(struct lval*) * cap;
+}
+
+// An empty buffer of cap slots, whose claimed range starts at lo
+struct lcells* lcells_new(int cap, int lo) {
+    struct lcells* b = lmem_alloc(lcells_size(cap));
+    b->refs = 1;
+    b->cap = cap;
+    b->lo = lo;
+    b->hi = lo;
+    return b;
+}
+
+void lcells_del(struct lcells* b) {
+    if (b == NULL || --b->refs > 0) return;
+    for (int i = b->lo; i < b->hi; i++) lval_del(b->slots[i]);
+    lmem_free(b, lcells_size(b->cap));
+}
+
+// Gives v a buffer of exactly n cells, to be filled in by the caller
+void lval_cells_alloc(struct lval* v, int n) {
+    v->buf = lcells_new(n, 0);
+    v->buf->hi = n;
+    v->count = n;
+    v->cell = v->buf->slots;
+}
+
+// Releases the claimed slots of v's buffer that v's view doesn't cover
+void lval_cells_trim(struct lval* v) {
+    struct lcells* b = v->buf;
+    int start = v->cell - b->slots;
+    for (int i = b->lo; i < start; i++) lval_del(b->slots[i]);
+    for (int i = start + v->count; i < b->hi; i++) lval_del(b->slots[i]);
+    b->lo = start;
+    b->hi = start + v->count;
+}
+
+// Moves v's view into a new buffer of cap slots, front of them spare
+// before it
+void lval_cells_move(struct lval* v, int cap, int front) {
+    struct lcells* b = lcells_new(cap, front);
+    struct lcells* old = v->buf;
+    if (old && old->refs == 1) {
+        lval_cells_trim(v);
+        memcpy(b->slots + front, v->cell, sizeof(struct lval*) * v->count);
+        lmem_free(old, lcells_size(old->cap));
+    } else {
+        for (int i = 0; i < v->count; i++) {
+            b->slots[front + i] = lval_copy(v->cell[i]);
+        }
+        lcells_del(old);
+    }
+    b->hi = front + v->count;
+    v->buf = b;
+    v->cell = b->slots + front;
+}
+
+// Makes v's buffer its own and claimed by its view alone, so its cells
+// can be changed in place
+void lval_cells_own(struct lval* v) {
+    if (v->buf == NULL) return;
+    if (v->buf->refs == 1) {
+        lval_cells_trim(v);
+    } else {
+        lval_cells_move(v, v->count, 0);
+    }
+}
+
+// Whether v can claim n more slots at its front or back where it is
+int lval_cells_fit(struct lval* v, int n, int at_front) {
+    struct lcells* b = v->buf;
+    if (b == NULL) return 0;
+    int start = v->cell - b->slots;
+    if (at_front) return start == b->lo && b->lo >= n;
+    return start + v->count == b->hi && b->cap - b->hi >= n;
+}
+
+// Gives empty v room for n cells, to be added with lval_add
+void lval_cells_hint(struct lval* v, int n) {
+    v->buf = lcells_new(n, 0);
+    v->cell = v->buf->slots;
+}
+
+// Makes room for n more cells at v's front or back
+void lval_cells_reserve(struct lval* v, int n, int at_front) {
+    if (lval_cells_fit(v, n, at_front)) return;
+    int cap = 2 * (v->count + n);
+    if (cap < 4) cap = 4;
+    lval_cells_move(v, cap, (cap - v->count) / 2);
+}
+
+// Packed vector of length uninitialized elements
+struct lval* lval_vec(int length) {
+    struct lval* v = lval_new(LVAL_VEC);
+    v->length = length;
+    v->items = lmem_alloc(sizeof(int64_t) * length);
     return v;
 }
 
+void lval_free(struct lval* v) {
+    v->refs = 0;
+    if (LGC_YOUNG(v)) {
+        LMEM_NEXT(&lmem_lvals, v) = lgc_young.free;
+        lgc_young.free = v;
+    } else {
+        lmem_pool_free(&lmem_lvals, v);
+    }
+}
+
 void lval_del(struct lval* v) {
+    if (--v->refs > 0) return;
+    if (LVAL_IMMEDIATE(v)) {
+        v->refs = 1;
+        return;
+    }
+
     switch(v->type) {
         case LVAL_BOOL:
         case LVAL_NUM:
             break;
+        case LVAL_BIG: lbig_free(v->big.digits, v->big.count); break;
+        case LVAL_VEC: lmem_free(v->items, sizeof(int64_t) * v->length); break;
         case LVAL_FUN:
             switch (v->fun_type) {
                 case LVAL_FUN_BUILTIN:
-                    free(v->name);
                     break;
                 case LVAL_FUN_LAMBDA:
                     lenv_del(v->env);
                     lval_del(v->args);
                     lval_del(v->body);
+                    if (v->folded) lval_del(v->folded);
+                    if (v->code) lcode_del(v->code);
+                    if (v->jit) ljit_del(v->jit);
                     break;
             }
             break;
 
         case LVAL_ERR: free(v->err); break;
-        case LVAL_SYM: free(v->sym); break;
+        case LVAL_SYM: break;
 
         case LVAL_SEXP:
         case LVAL_QEXP:
-            for (int i = 0; i < v->count; i++) {
-                lval_del(v->cell[i]);
-            }
-            free(v->cell);
+            lcells_del(v->buf);
             break;
     }
-    free(v);
+    lval_free(v);
 }
 
 #define LASSERT(v, cond, msg, ...)                          \
@@ -266,6 +1272,17 @@ void lval_del(struct lval* v) {
         lval_type_name(v->cell[i]->type),   \
         lval_type_name(t));                 \
 
+#define LNUMBER(v, i, source)                               \
+    LASSERT(                                                \
+        v,                                                  \
+        v->cell[i]->type == LVAL_NUM ||                     \
+        v->cell[i]->type == LVAL_BIG,                       \
+        "Wrong type for arg %i in '%s'. "                   \
+        "Got %s, expected %s",                              \
+        i, source,                                          \
+        lval_type_name(v->cell[i]->type),                   \
+        lval_type_name(LVAL_NUM));                          \
+
 #define LNONEMPTY(v, i, source)                         \
     LASSERT(                                            \
         v,                                              \
@@ -275,70 +1292,164 @@ void lval_del(struct lval* v) {
         source, i);                                     \
 
 struct lval* lval_add(struct lval* v, struct lval* x) {
-    v->count += 1;
-    v->cell = realloc(v->cell, v->count * sizeof(struct lval*));
-    v->cell[v->count - 1] = x;
+    lval_cells_reserve(v, 1, 0);
+    v->buf->slots[v->buf->hi++] = x;
+    v->count++;
     return v;
 }
 
-struct lval* lval_pop(struct lval* v, int i) {
+struct lval* lval_add_front(struct lval* v, struct lval* x) {
+    lval_cells_reserve(v, 1, 1);
+    v->buf->slots[--v->buf->lo] = x;
+    v->cell--;
+    v->count++;
+    return v;
+}
 
+struct lval* lval_pop(struct lval* v, int i) {
+    lval_cells_own(v);
+    struct lcells* b = v->buf;
     struct lval* x = v->cell[i];
 
+    // Close the gap from whichever end is nearer
     int width = sizeof(struct lval*);
-
-    memmove(&v->cell[i], &v->cell[i + 1], width * (v->count - i - 1));
-
+    if (i < v->count / 2) {
+        memmove(&v->cell[1], &v->cell[0], width * i);
+        v->cell++;
+        b->lo++;
+    } else {
+        memmove(&v->cell[i], &v->cell[i + 1], width * (v->count - i - 1));
+        b->hi--;
+    }
     v->count -= 1;
 
-    v->cell = realloc(v->cell, width * v->count);
+    // Give back memory once most of it is spare
+    if (b->cap > 16 && v->count * 4 < b->cap) {
+        lval_cells_move(v, 2 * v->count, v->count / 2);
+    }
 
     return x;
 }
 
 struct lval* lval_take(struct lval* v, int i) {
+    // Copy rather than pop out of cells someone else can see
+    if (v->refs > 1 || v->buf->refs > 1) {
+        struct lval* x = lval_copy(v->cell[i]);
+        lval_del(v);
+        return x;
+    }
     struct lval* x = lval_pop(v, i);
     lval_del(v);
     return x;
 }
 
+// A list header for v's cells that is ours to extend. Only the header is
+// copied, while the cells stay shared
+struct lval* lval_view(struct lval* v) {
+    if (v->refs == 1) return v;
+    struct lval* x = lval_new(v->type);
+    x->count = v->count;
+    x->site = 0;
+    x->buf = v->buf;
+    x->cell = v->cell;
+    x->target = 0;
+    if (x->buf) x->buf->refs++;
+    lval_del(v);
+    return x;
+}
+
+// The count cells of v from start on, sharing v's buffer. Nothing is
+// copied until one side changes its cells, while appending to a slice
+// that ends where v does still claims in place, as v can't see that
+struct lval* lval_slice(struct lval* v, int start, int count) {
+    v = lval_view(v);
+    v->cell += start;
+    v->count = count;
+    return v;
+}
+
+// Appends x to v by claiming the slots after v, or else prepends v to x
+// by claiming those before x, so only one side is ever copied
 struct lval* lval_join(struct lval* v, struct lval* x) {
-    while (x->count) {
-        v = lval_add(v, lval_pop(x, 0));
+    if (!lval_cells_fit(v, x->count, 0) && lval_cells_fit(x, v->count, 1)) {
+        int n = v->count;
+        x = lval_view(x);
+        x->buf->lo -= n;
+        x->cell -= n;
+        x->count += n;
+        x->type = v->type;
+        for (int i = 0; i < n; i++) x->cell[i] = lval_copy(v->cell[i]);
+        lval_del(v);
+        return x;
     }
+
+    int n = x->count;
+    v = lval_view(v);
+    lval_cells_reserve(v, n, 0);
+    for (int i = 0; i < n; i++) {
+        v->buf->slots[v->buf->hi++] = lval_copy(x->cell[i]);
+    }
+    v->count += n;
     lval_del(x);
     return v;
 }
 
 struct lval* lval_copy(struct lval* v) {
-    struct lval* x = malloc(sizeof(struct lval));
-    x->type = v->type;
+    v->refs++;
+    return v;
+}
+
+// Shallow copy: a new top-level value sharing v's children
+struct lval* lval_clone(struct lval* v) {
+    struct lval* x = lval_new(v->type);
     switch(v->type) {
         case LVAL_BOOL: x->flag = v->flag; break;
         case LVAL_NUM: x->num = v->num; break;
+        case LVAL_BIG:
+            x->big = v->big;
+            x->big.digits = lbig_alloc(v->big.count);
+            memcpy(x->big.digits, v->big.digits,
+                sizeof(uint32_t) * v->big.count);
+            break;
+        case LVAL_VEC:
+            x->length = v->length;
+            x->items = lmem_alloc(sizeof(int64_t) * v->length);
+            memcpy(x->items, v->items, sizeof(int64_t) * v->length);
+            break;
 
         case LVAL_ERR: STR_COPY(x->err, v->err); break;
-        case LVAL_SYM: STR_COPY(x->sym, v->sym); break;
+        case LVAL_SYM:
+            x->sym = v->sym;
+            x->depth = v->depth;
+            x->slot = v->slot;
+            x->cache = v->cache;
+            x->stamp = v->stamp;
+            break;
 
         case LVAL_FUN:
             x->fun_type = v->fun_type;
+            x->serial = v->serial;
             switch (v->fun_type) {
                 case LVAL_FUN_BUILTIN:
-                    STR_COPY(x->name, v->name);
+                    x->name = v->name;
                     x->builtin = v->builtin;
                     break;
                 case LVAL_FUN_LAMBDA:
                     x->env = lenv_copy(v->env);
+                    x->code = v->code ? lcode_copy(v->code) : NULL;
+                    x->jit = v->jit ? ljit_copy(v->jit) : NULL;
                     x->args = lval_copy(v->args);
                     x->body = lval_copy(v->body);
+                    x->folded = v->folded ? lval_copy(v->folded) : NULL;
                     break;
             }
             break;
 
         case LVAL_SEXP:
         case LVAL_QEXP:
-            x->count = v->count;
-            x->cell = malloc(sizeof(struct lval*) * x->count);
+            x->site = 0;
+            x->target = 0;
+            lval_cells_alloc(x, v->count);
             for (int i = 0; i < x->count; i++) {
                 x->cell[i] = lval_copy(v->cell[i]);
             }
@@ -348,11 +1459,322 @@ struct lval* lval_copy(struct lval* v) {
     return x;
 }
 
+// Copy-on-write: returns v itself when it has no other owners
+struct lval* lval_own(struct lval* v) {
+    if (v->refs == 1) {
+        if (v->type == LVAL_SEXP || v->type == LVAL_QEXP) lval_cells_own(v);
+        return v;
+    }
+    struct lval* x = lval_clone(v);
+    lval_del(v);
+    return x;
+}
+
+// Tracing mark-sweep collector backing up the reference counts. The
+// roots are the active environment chain plus a shadow stack of the
+// values the evaluator is working on, so anything unreachable from
+// them has been leaked and can be reclaimed. Marks live in a high bit
+// of refs while a collection runs.
+#define LGC_MARK (1 << 30)
+
+struct lgc_stack {
+    int count;
+    int cap;
+    struct lval** vals;
+};
+
+struct lgc_stack lgc_roots = { 0, 0, NULL };
+struct lgc_stack lgc_grey = { 0, 0, NULL };
+
+void lgc_stack_push(struct lgc_stack* s, struct lval* v) {
+    if (s->count == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 256;
+        s->vals = realloc(s->vals, sizeof(struct lval*) * s->cap);
+    }
+    s->vals[s->count++] = v;
+}
+
+#define LGC_PUSH(v) lgc_stack_push(&lgc_roots, v)
+#define LGC_POP() (lgc_roots.count--)
+
+struct lgc_stats {
+    long collections;
+    long freed;
+    double pause;
+};
+
+struct lgc_stats lgc_last = { 0, 0, 0.0 };
+
+void lgc_mark(struct lval* v) {
+    if (LVAL_IMMEDIATE(v) || (v->refs & LGC_MARK)) return;
+    v->refs |= LGC_MARK;
+    lgc_stack_push(&lgc_grey, v);
+}
+
+void lgc_mark_env(struct lenv* e) {
+    int n = e->cap ? e->cap : e->count;
+    for (int i = 0; i < n; i++) {
+        if (e->syms[i] >= 0) lgc_mark(e->vals[i]);
+    }
+}
+
+void lgc_trace(void) {
+    while (lgc_grey.count) {
+        struct lval* v = lgc_grey.vals[--lgc_grey.count];
+        switch (v->type) {
+            case LVAL_FUN:
+                if (v->fun_type == LVAL_FUN_LAMBDA) {
+                    // a shared frame is marked once, as list buffers are
+                    if (!(v->env->refs & LGC_MARK)) {
+                        v->env->refs |= LGC_MARK;
+                        lgc_mark_env(v->env);
+                    }
+                    lgc_mark(v->args);
+                    lgc_mark(v->body);
+                    if (v->folded) lgc_mark(v->folded);
+                }
+                break;
+            case LVAL_SEXP:
+            case LVAL_QEXP:
+                // the whole buffer stays alive, once however many
+                // lists share it
+                if (v->buf && !(v->buf->refs & LGC_MARK)) {
+                    v->buf->refs |= LGC_MARK;
+                    for (int i = v->buf->lo; i < v->buf->hi; i++) {
+                        lgc_mark(v->buf->slots[i]);
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Garbage may hold references to survivors, which must be given back
+void lgc_unref(struct lval* v) {
+    if (!LVAL_IMMEDIATE(v) && (v->refs & LGC_MARK)) v->refs--;
+}
+
+void lgc_release(struct lval* v) {
+    switch (v->type) {
+        case LVAL_FUN:
+            if (v->fun_type == LVAL_FUN_LAMBDA) {
+                // and freed with the last lambda using it
+                struct lenv* e = v->env;
+                if ((--e->refs & ~LGC_MARK) == 0) {
+                    for (int i = 0; i < e->count; i++) lgc_unref(e->vals[i]);
+                    lenv_count_locals(e, -1);
+                    lenv_free(e);
+                }
+                v->env = NULL;
+                lgc_unref(v->args);
+                lgc_unref(v->body);
+                if (v->folded) lgc_unref(v->folded);
+            }
+            break;
+        case LVAL_SEXP:
+        case LVAL_QEXP:
+            // a buffer dies with the last list using it, which is freed
+            // here as lgc_free is too late for the unrefs
+            if (v->buf && (--v->buf->refs & ~LGC_MARK) == 0) {
+                for (int i = v->buf->lo; i < v->buf->hi; i++) {
+                    lgc_unref(v->buf->slots[i]);
+                }
+                lmem_free(v->buf, lcells_size(v->buf->cap));
+            }
+            v->buf = NULL;
+            break;
+        default:
+            break;
+    }
+}
+
+// Frees v's own storage without touching the lvals it points to
+void lgc_free(struct lval* v) {
+    switch (v->type) {
+        case LVAL_ERR: free(v->err); break;
+        case LVAL_BIG: lbig_free(v->big.digits, v->big.count); break;
+        case LVAL_VEC: lmem_free(v->items, sizeof(int64_t) * v->length); break;
+        case LVAL_FUN:
+            if (v->fun_type == LVAL_FUN_LAMBDA) {
+                if (v->code) lcode_del(v->code);
+                if (v->jit) ljit_del(v->jit);
+            }
+            break;
+        default:
+            // list buffers went in lgc_release
+            break;
+    }
+    lval_free(v);
+}
+
+// Heap range c: the pool chunks, then the used part of the nursery
+struct lval* lgc_range(int c, int end) {
+    if (c == lmem_lvals.nchunks) {
+        return end ? lgc_young.next : lgc_young.start;
+    }
+    struct lval* chunk = (struct lval*) lmem_lvals.chunks[c];
+    return end ? chunk + LMEM_CHUNK / sizeof(struct lval) : chunk;
+}
+
+#define LGC_EACH(v)                                                     \
+    for (int c = 0; c <= lmem_lvals.nchunks; c++)                       \
+        for (struct lval *v = lgc_range(c, 0), *v##_end = lgc_range(c, 1); \
+             v < v##_end; v++)
+
+void lgc_collect(struct lenv* e) {
+    clock_t start = clock();
+
+    for (; e; e = e->parent) lgc_mark_env(e);
+    for (int i = 0; i < lgc_roots.count; i++) lgc_mark(lgc_roots.vals[i]);
+    lgc_trace();
+
+    LGC_EACH(v) {
+        if (v->refs && !(v->refs & LGC_MARK)) lgc_release(v);
+    }
+
+    long freed = 0;
+    LGC_EACH(v) {
+        if (v->refs == 0) continue;
+        if (v->refs & LGC_MARK) {
+            v->refs &= ~LGC_MARK;
+            if ((v->type == LVAL_SEXP || v->type == LVAL_QEXP) && v->buf) {
+                v->buf->refs &= ~LGC_MARK;
+            }
+            if (v->type == LVAL_FUN && v->fun_type == LVAL_FUN_LAMBDA) {
+                v->env->refs &= ~LGC_MARK;
+            }
+        } else {
+            lgc_free(v);
+            freed++;
+        }
+    }
+
+    lgc_last.collections++;
+    lgc_last.freed = freed;
+    lgc_last.pause = (double) (clock() - start) * 1000 / CLOCKS_PER_SEC;
+}
+
+int lgc_has_young(struct lval* v) {
+    if (LGC_YOUNG(v)) return 1;
+    switch (v->type) {
+        case LVAL_FUN:
+            if (v->fun_type == LVAL_FUN_LAMBDA) {
+                if (lgc_has_young(v->args) || lgc_has_young(v->body)
+                        || (v->folded && lgc_has_young(v->folded))) {
+                    return 1;
+                }
+                int n = v->env->cap ? v->env->cap : v->env->count;
+                for (int i = 0; i < n; i++) {
+                    if (v->env->syms[i] >= 0
+                            && lgc_has_young(v->env->vals[i])) {
+                        return 1;
+                    }
+                }
+            }
+            return 0;
+        case LVAL_SEXP:
+        case LVAL_QEXP:
+            for (int i = 0; i < v->count; i++) {
+                if (lgc_has_young(v->cell[i])) return 1;
+            }
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+struct lval* lgc_promote(struct lval* v);
+
+void lgc_promote_slot(struct lval** slot) {
+    struct lval* x = *slot;
+    *slot = lgc_promote(x);
+    lval_del(x);
+}
+
+// Returns a reference to an equal value with nothing in the nursery,
+// copying only the parts of v that are young
+struct lval* lgc_promote(struct lval* v) {
+    if (!lgc_has_young(v)) return lval_copy(v);
+
+    lgc_tenure++;
+    struct lval* x = lval_clone(v);
+    lgc_tenure--;
+    lgc_young.promoted++;
+
+    switch (x->type) {
+        case LVAL_FUN:
+            if (x->fun_type == LVAL_FUN_LAMBDA) {
+                lgc_promote_slot(&x->args);
+                lgc_promote_slot(&x->body);
+                if (x->folded) lgc_promote_slot(&x->folded);
+                // bytecode points into the body, so follow it if it was
+                // copied. A partial application shares its prototype's
+                // body, which is usually old already
+                if (x->code && (x->body != v->body
+                        || x->folded != v->folded)) {
+                    lcode_del(x->code);
+                    x->code = lvm_compile(x->folded ? x->folded : x->body);
+                }
+                int young = 0;
+                for (int i = 0; i < x->env->count && !young; i++) {
+                    young = lgc_has_young(x->env->vals[i]);
+                }
+                if (young) {
+                    x->env = lenv_own(x->env);
+                    for (int i = 0; i < x->env->count; i++) {
+                        lgc_promote_slot(&x->env->vals[i]);
+                    }
+                }
+            }
+            break;
+        case LVAL_SEXP:
+        case LVAL_QEXP:
+            for (int i = 0; i < x->count; i++) lgc_promote_slot(&x->cell[i]);
+            break;
+        default:
+            break;
+    }
+    return x;
+}
+
+long lgc_young_live(void) {
+    long live = 0;
+    for (struct lval* v = lgc_young.start; v < lgc_young.next; v++) {
+        if (v->refs) live++;
+    }
+    return live;
+}
+
+// Only called between top-level expressions, when nothing outside the
+// root env is alive. Anything still young then has been leaked, so a
+// full collection clears it before the nursery is reset.
+void lgc_minor(struct lenv* root) {
+    clock_t start = clock();
+
+    if (lgc_young_live()) lgc_collect(root);
+    if (lgc_young_live() == 0) {
+        lgc_young.next = lgc_young.start;
+        lgc_young.free = NULL;
+    }
+
+    lgc_young.minors++;
+    lgc_young.pause = (double) (clock() - start) * 1000 / CLOCKS_PER_SEC;
+    lgc_young.total_pause += lgc_young.pause;
+}
+
 void lval_print(struct lval* v) {
     switch (v->type) {
         case LVAL_ERR: printf("Error: %s", v->err); break;
         case LVAL_NUM: printf("%li", v->num); break;
-        case LVAL_SYM: printf("%s", v->sym); break;
+        case LVAL_BIG: {
+            char* s = lbig_string(v);
+            printf("%s", s);
+            free(s);
+            break;
+        }
+        case LVAL_SYM: printf("%s", lsym_name(v->sym)); break;
         case LVAL_BOOL: printf(v->flag ? "#t" : "#f"); break;
 
         case LVAL_FUN:
@@ -380,12 +1802,20 @@ void lval_print(struct lval* v) {
             }
             putchar(v->type == LVAL_SEXP ? ')' : '}');
             break;
+
+        case LVAL_VEC:
+            putchar('[');
+            for (int i = 0; i < v->length; i++) {
+                printf(i ? " %lli" : "%lli", (long long) v->items[i]);
+            }
+            putchar(']');
+            break;
     }
 }
 
 void lenv_add_builtin(struct lenv* e, char* name, lfunc fn) {
     struct lval* v = lval_builtin(name, fn);
-    lenv_put(e, name, v);
+    lenv_put(e, lsym_intern(name), v);
     lval_del(v);
 }
 
@@ -394,6 +1824,8 @@ struct lval* lval_read_num(char* value) {
     long x = strtol(value, NULL, 10);
     if (errno == 0) {
         return lval_num(x);
+    } else if (errno == ERANGE) {
+        return lbig_read(value);
     } else {
         return lval_err("Unknown number %s", value);
     }
@@ -429,7 +1861,7 @@ struct lval* lval_read(mpc_ast_t* node) {
         return lval_read_num(node->contents);
     }
     if (strstr(node->tag, "symbol")) {
-        return lval_sym(node->contents);
+        return lval_sym(lsym_intern(node->contents));
     }
     if (strstr(node->tag, "bool")) {
         return lval_read_bool(node->contents);
@@ -453,10 +1885,104 @@ struct lval* lval_read(mpc_ast_t* node) {
     return x;
 }
 
+// Reads every top-level expression of a file into one sexp
+struct lval* lval_read_file(mpc_ast_t* node) {
+    struct lval* x = lval_sexp();
+    for (int i = 0; i < node->children_num; i++) {
+        if (read_ignore(node->children[i])) continue;
+        x = lval_add(x, lval_read(node->children[i]));
+    }
+    return x;
+}
+
 struct lval* lval_eval(struct lenv* e, struct lval* v);
 
+struct lval* lval_eval_ref(struct lenv* e, struct lval* v);
+
 struct lval* lval_eval_sexp(struct lenv* e, struct lval* v);
 
+struct lval* lvm_exec(struct lenv* e, struct lcode* code);
+
+// Proper tail calls. Lambda calls and the if and eval builtins don't
+// evaluate their final expression themselves; they return lval_tail
+// with the work left in ltail, and the nearest enclosing ltail_run
+// carries it out in a loop. Frames replaced by a tail call that only
+// rebinds the same names are released at once, so self-recursive loops
+// run in constant C stack and memory.
+struct ltail {
+    struct lenv* env;
+    struct lval* expr;  // qexp or sexp to evaluate as an sexp, owned
+    struct lval* frame; // lambda whose body to run, owned
+};
+
+struct ltail ltail = { NULL, NULL, NULL };
+struct lval lval_tail;
+
+struct lval* ltail_call(struct lenv* e, struct lval* expr, struct lval* frame) {
+    ltail.env = e;
+    ltail.expr = expr;
+    ltail.frame = frame;
+    return &lval_tail;
+}
+
+// Does a bind every name that b does?
+int lenv_shadows(struct lenv* a, struct lenv* b) {
+    for (int i = 0; i < b->count; i++) {
+        int found = 0;
+        for (int j = 0; j < a->count && !found; j++) {
+            found = a->syms[j] == b->syms[i];
+        }
+        if (!found) return 0;
+    }
+    return 1;
+}
+
+// How many ltail_runs are active
+int ltail_depth = 0;
+
+struct lval* ltail_run(struct lval* r) {
+    struct lval* frame = NULL;
+    int held = 0;
+    ltail_depth++;
+
+    while (r == &lval_tail) {
+        struct lenv* e = ltail.env;
+        struct lval* expr = ltail.expr;
+        struct lval* f = ltail.frame;
+
+        if (f) {
+            // With dynamic scope the new frame's parent is the frame it
+            // replaces; skip over that frame when it is fully shadowed
+            if (frame && f->env->parent == frame->env &&
+                lenv_shadows(f->env, frame->env)) {
+                f->env->parent = frame->env->parent;
+                LGC_POP();
+                held--;
+                lval_del(frame);
+            }
+            LGC_PUSH(f);
+            held++;
+            frame = f;
+        }
+
+        if (expr) {
+            LGC_PUSH(expr);
+            r = lval_eval_sexp(e, expr);
+            LGC_POP();
+            lval_del(expr);
+        } else {
+            r = lvm_exec(e, f->code);
+        }
+    }
+
+    if (ljit_reruns) ljit_end_reruns(ltail_depth);
+    ltail_depth--;
+    while (held--) {
+        lval_del(lgc_roots.vals[--lgc_roots.count]);
+    }
+    return r;
+}
+
 struct lval* lval_builtin_head(struct lenv* e, struct lval* v) {
     LNUMARGS(v, 1, "head");
     LNONEMPTY(v, 0, "head");
@@ -477,8 +2003,7 @@ struct lval* lval_builtin_tail(struct lenv* e, struct lval* v) {
     LNONEMPTY(v, 0, "tail");
 
     struct lval* x = lval_take(v, 0);
-    lval_del(lval_pop(x, 0));
-    return x;
+    return lval_slice(x, 1, x->count - 1);
 }
 
 struct lval* lval_builtin_init(struct lenv* e, struct lval* v) {
@@ -486,8 +2011,23 @@ struct lval* lval_builtin_init(struct lenv* e, struct lval* v) {
     LNONEMPTY(v, 0, "init");
 
     struct lval* x = lval_take(v, 0);
-    lval_del(lval_pop(x, x->count - 1));
-    return x;
+    return lval_slice(x, 0, x->count - 1);
+}
+
+struct lval* lval_builtin_slice(struct lenv* e, struct lval* v) {
+    LNUMARGS(v, 3, "slice");
+    LTYPE(v, LVAL_QEXP, 0, "slice");
+    LTYPE(v, LVAL_NUM, 1, "slice");
+    LTYPE(v, LVAL_NUM, 2, "slice");
+
+    // Cells start up to but not including end, like a half-open range
+    long start = v->cell[1]->num;
+    long end = v->cell[2]->num;
+    LASSERT(v, 0 <= start && start <= end && end <= v->cell[0]->count,
+        "Slice %li to %li out of range for 'slice' of %i cells",
+        start, end, v->cell[0]->count);
+
+    return lval_slice(lval_take(v, 0), start, end - start);
 }
 
 struct lval* lval_builtin_list(struct lenv* e, struct lval* v) {
@@ -497,9 +2037,12 @@ struct lval* lval_builtin_list(struct lenv* e, struct lval* v) {
 
 struct lval* lval_builtin_len(struct lenv* e, struct lval* v) {
     LNUMARGS(v, 1, "len");
-    LTYPE(v, LVAL_QEXP, 0, "len");
+    if (v->cell[0]->type != LVAL_VEC) {
+        LTYPE(v, LVAL_QEXP, 0, "len");
+    }
 
-    struct lval* x = lval_num(v->cell[0]->count);
+    struct lval* x = lval_num(v->cell[0]->type == LVAL_VEC
+        ? v->cell[0]->length : v->cell[0]->count);
     lval_del(v);
 
     return x;
@@ -509,28 +2052,19 @@ struct lval* lval_builtin_eval(struct lenv* e, struct lval* v) {
     LNUMARGS(v, 1, "eval");
     LTYPE(v, LVAL_QEXP, 0, "eval");
 
-    struct lval* x = lval_take(v, 0);
-    x->type = LVAL_SEXP;
-    return lval_eval(e, x);
+    return ltail_call(e, lval_take(v, 0), NULL);
 }
 
 struct lval* lval_builtin_cons(struct lenv* e, struct lval* v) {
     LNUMARGS(v, 2, "cons");
     LTYPE(v, LVAL_QEXP, 1, "cons");
 
-    // New q-exp with first arg
-    struct lval* x = lval_qexp();
-    lval_add(x, lval_pop(v, 0));
-
-    // Old q-exp from second arg
-    struct lval* q = lval_take(v, 0);
-
-    while (q->count) {
-        lval_add(x, lval_pop(q, 0));
-    }
-    lval_del(q);
+    // Put the first arg in front of the old q-exp
+    struct lval* x = lval_pop(v, 0);
+    struct lval* q = lval_view(lval_take(v, 0));
+    lval_add_front(q, x);
 
-    return lval_eval(e, x);
+    return lval_eval(e, q);
 }
 
 struct lval* lval_builtin_join(struct lenv* e, struct lval* v) {
@@ -562,10 +2096,7 @@ struct lval* lval_builtin_if(struct lenv* e, struct lval* v) {
 
     int result = v->cell[0]->flag;
 
-    struct lval* x = lval_sexp();
-    lval_add(x, lval_take(v, result ? 1 : 2));
-
-    return lval_builtin_eval(e, x);
+    return ltail_call(e, lval_take(v, result ? 1 : 2), NULL);
 }
 
 int lval_equal(struct lval* x, struct lval* y) {
@@ -573,8 +2104,12 @@ int lval_equal(struct lval* x, struct lval* y) {
     switch (x->type) {
         case LVAL_ERR: return 0;
         case LVAL_NUM: return x->num == y->num;
+        case LVAL_BIG: return lbig_compare(x, y) == 0;
+        case LVAL_VEC:
+            return x->length == y->length && (x->length == 0 ||
+                memcmp(x->items, y->items, sizeof(int64_t) * x->length) == 0);
         case LVAL_BOOL: return x->flag == y->flag;
-        case LVAL_SYM: return strcmp(x->sym, y->sym) == 0;
+        case LVAL_SYM: return x->sym == y->sym;
         case LVAL_FUN:
             if (x->fun_type != y->fun_type) return 0;
             switch (x->fun_type) {
@@ -596,126 +2131,578 @@ int lval_equal(struct lval* x, struct lval* y) {
     }
 }
 
-int lval_eval_compare(char* sym, struct lval* x, struct lval* y) {
-
-    if (strcmp(sym, "<") == 0) return x->num < y->num;
-    else if (strcmp(sym, ">") == 0) return x->num > y->num;
-    else if (strcmp(sym, ">=") == 0) return x->num >= y->num;
-    else if (strcmp(sym, "<=") == 0) return x->num <= y->num;
-    else if (strcmp(sym, "=") == 0) return lval_equal(x, y);
-    else if (strcmp(sym, "!=") == 0) return !lval_equal(x, y);
+// Arithmetic and comparison builtins share their evaluators and are told
+// apart by opcode, which indexes the tables below
+enum lop {
+    LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV, LOP_MOD, LOP_POW, LOP_MIN, LOP_MAX,
+    LOP_LT, LOP_LTE, LOP_GT, LOP_GTE, LOP_EQ, LOP_NEQ, LOP_COUNT
+};
 
-    return 0;
-}
+char* lop_names[LOP_COUNT] = {
+    "+", "-", "*", "/", "%", "^", "min", "max",
+    "<", "<=", ">", ">=", "=", "!="
+};
 
-struct lval* lval_eval_comp(struct lenv* e, char* sym, struct lval* v) {
-    if (strcmp(sym, "=") != 0 || strcmp(sym, "!=") != 0) {
-        for (int i = 0; i < v->count; i++) {
-            LTYPE(v, LVAL_NUM, i, sym);
-        }
+// Fixnum arithmetic checks for overflow, and only a result that
+// doesn't fit a long is redone with bignums
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+    #define LOP_ADD_OVERFLOW(a, b, r) __builtin_add_overflow(a, b, r)
+    #define LOP_SUB_OVERFLOW(a, b, r) __builtin_sub_overflow(a, b, r)
+    #define LOP_MUL_OVERFLOW(a, b, r) __builtin_mul_overflow(a, b, r)
+#else
+    int lop_add_overflow(long a, long b, long* r) {
+        if (b > 0 ? a > LONG_MAX - b : a < LONG_MIN - b) return 1;
+        *r = a + b;
+        return 0;
     }
 
-    if (v->count <= 1) {
-        lval_del(v);
-        return lval_bool(1);
+    int lop_sub_overflow(long a, long b, long* r) {
+        if (b < 0 ? a > LONG_MAX + b : a < LONG_MIN + b) return 1;
+        *r = a - b;
+        return 0;
     }
 
-    struct lval* x = lval_pop(v, 0);
-
-    int result = 1;
-    while (v->count > 0) {
-        struct lval* y = lval_pop(v, 0);
-        if (lval_eval_compare(sym, x, y)) {
-            lval_del(x);
-            x = y;
-        } else {
-            lval_del(y);
-            result = 0;
-            break;
+    int lop_mul_overflow(long a, long b, long* r) {
+        if (a > 0 ? (b > 0 ? a > LONG_MAX / b : b < LONG_MIN / a)
+                : (b > 0 ? a < LONG_MIN / b : b && a < LONG_MAX / b)) {
+            return 1;
         }
+        *r = a * b;
+        return 0;
     }
 
-    lval_del(x);
-    lval_del(v);
+    #define LOP_ADD_OVERFLOW(a, b, r) lop_add_overflow(a, b, r)
+    #define LOP_SUB_OVERFLOW(a, b, r) lop_sub_overflow(a, b, r)
+    #define LOP_MUL_OVERFLOW(a, b, r) lop_mul_overflow(a, b, r)
+#endif
 
-    return lval_bool(result);
+// Each folds b into the running result *x. They return 0, leaving *x
+// alone, when the result doesn't fit a long, and -1 on division by 0
+typedef int (*lop_arith)(long* x, long b);
+
+int lop_add(long* x, long b) {
+    long r;
+    if (LOP_ADD_OVERFLOW(*x, b, &r)) return 0;
+    *x = r;
+    return 1;
 }
 
-struct lval* lval_eval_binary(
-    char* sym, struct lval* x, struct lval* y
-) {
-    long a = x->num;
-    long b = y->num;
+int lop_sub(long* x, long b) {
+    long r;
+    if (LOP_SUB_OVERFLOW(*x, b, &r)) return 0;
+    *x = r;
+    return 1;
+}
 
-    if (strcmp(sym, "+") == 0) x->num = a + b;
-    else if (strcmp(sym, "-") == 0) x->num = a - b;
-    else if (strcmp(sym, "*") == 0) x->num = a * b;
-    else if (strcmp(sym, "^") == 0) x->num = pow(a, b);
-    else if (strcmp(sym, "min") == 0) x->num = a < b ? a : b;
-    else if (strcmp(sym, "max") == 0) x->num = a > b ? a : b;
-    else if (strcmp(sym, "/") == 0) {
-        LASSERT(x, b != 0, "Division by 0");
-        x->num = a / b;
-    }
-    else if (strcmp(sym, "%") == 0) {
-        LASSERT(x, b != 0, "Division by 0");
-        x->num = a % b;
+int lop_mul(long* x, long b) {
+    long r;
+    if (LOP_MUL_OVERFLOW(*x, b, &r)) return 0;
+    *x = r;
+    return 1;
+}
+
+int lop_min(long* x, long b) { if (b < *x) *x = b; return 1; }
+int lop_max(long* x, long b) { if (b > *x) *x = b; return 1; }
+
+int lop_div(long* x, long b) {
+    if (b == 0) return -1;
+    if (b == -1 && *x == LONG_MIN) return 0;
+    *x /= b;
+    return 1;
+}
+
+int lop_mod(long* x, long b) {
+    if (b == 0) return -1;
+    // LONG_MIN % -1 traps
+    *x = b == -1 ? 0 : *x % b;
+    return 1;
+}
+
+// Repeated squaring, exact where pow()'s doubles were not
+int lop_pow(long* x, long b) {
+    long base = *x, r = 1;
+    if (b < 0) {
+        // only 1 and -1 have integral inverses
+        if (base == 0) return -1;
+        *x = base == 1 || (base == -1 && b % 2 == 0) ? 1
+            : base == -1 ? -1 : 0;
+        return 1;
     }
-    else {
-        LASSERT(x, 0, "Unknown operator %s", sym);
+    for (; b; b >>= 1) {
+        if ((b & 1) && LOP_MUL_OVERFLOW(r, base, &r)) return 0;
+        if (b > 1 && LOP_MUL_OVERFLOW(base, base, &base)) return 0;
     }
-
-    return x;
+    *x = r;
+    return 1;
 }
 
-struct lval* lval_eval_op(struct lenv* e, char* sym, struct lval* v) {
-    for (int i = 0; i < v->count; i++) {
-        LTYPE(v, LVAL_NUM, i, sym);
+lop_arith lop_arith_fns[LOP_LT] = {
+    lop_add, lop_sub, lop_mul, lop_div, lop_mod, lop_pow, lop_min, lop_max
+};
+
+// The slow path: folds b into x, either of which may be a bignum
+struct lval* lop_big(enum lop op, struct lval* x, struct lval* b) {
+    switch (op) {
+        case LOP_ADD: return lbig_add(x, b, 0);
+        case LOP_SUB: return lbig_add(x, b, 1);
+        case LOP_MUL: return lbig_mul(x, b);
+        case LOP_DIV: return lbig_div(x, b, 0);
+        case LOP_MOD: return lbig_div(x, b, 1);
+        case LOP_POW: return lbig_pow(x, b);
+        case LOP_MIN: return lval_copy(lbig_compare(b, x) < 0 ? b : x);
+        case LOP_MAX: return lval_copy(lbig_compare(b, x) > 0 ? b : x);
+        default: return lval_err("Unknown operator '%s'", lop_names[op]);
     }
+}
 
-    LASSERT(v, v->count > 0, "No arguments passed to '%s'", sym);
+typedef int (*lop_compare)(struct lval* x, struct lval* y);
 
-    struct lval* x = lval_pop(v, 0);
+int lop_lt(struct lval* x, struct lval* y) { return lbig_compare(x, y) < 0; }
+int lop_lte(struct lval* x, struct lval* y) { return lbig_compare(x, y) <= 0; }
+int lop_gt(struct lval* x, struct lval* y) { return lbig_compare(x, y) > 0; }
+int lop_gte(struct lval* x, struct lval* y) { return lbig_compare(x, y) >= 0; }
+int lop_eq(struct lval* x, struct lval* y) { return lval_equal(x, y); }
+int lop_neq(struct lval* x, struct lval* y) { return !lval_equal(x, y); }
+
+lop_compare lop_compare_fns[LOP_COUNT - LOP_LT] = {
+    lop_lt, lop_lte, lop_gt, lop_gte, lop_eq, lop_neq
+};
 
-    if (v->count == 0) {
-        if (strcmp(sym, "-") == 0) x->num = -x->num;
+struct lval* lval_eval_comp(struct lenv* e, enum lop op, struct lval* v) {
+    // = and != compare any values, the orderings only numbers
+    if (op != LOP_EQ && op != LOP_NEQ) {
+        for (int i = 0; i < v->count; i++) {
+            LNUMBER(v, i, lop_names[op]);
+        }
     }
 
-    while (v->count > 0) {
-        struct lval* y = lval_pop(v, 0);
-        x = lval_eval_binary(sym, x, y);
-        lval_del(y);
+    lop_compare compare = lop_compare_fns[op - LOP_LT];
+    int result = 1;
+    for (int i = 0; i + 1 < v->count; i++) {
+        if (!compare(v->cell[i], v->cell[i + 1])) {
+            result = 0;
+            break;
+        }
     }
 
     lval_del(v);
 
-    return x;
+    return lval_bool(result);
 }
 
-struct lval* lval_builtin_def(struct lenv* e, struct lval* v) {
-    LTYPE(v, LVAL_QEXP, 0, "def");
+struct lval* lval_eval_op(struct lenv* e, enum lop op, struct lval* v) {
+    // Two fixnums is by far the common case
+    if (v->count == 2 && v->cell[0]->type == LVAL_NUM
+            && v->cell[1]->type == LVAL_NUM) {
+        long x = v->cell[0]->num;
+        int ok = lop_arith_fns[op](&x, v->cell[1]->num);
+        if (ok) {
+            lval_del(v);
+            return ok > 0 ? lval_num(x) : lval_err("Division by 0");
+        }
+    }
 
-    struct lval* syms = v->cell[0];
+    for (int i = 0; i < v->count; i++) {
+        LNUMBER(v, i, lop_names[op]);
+    }
 
-    for (int i = 0; i < syms->count; i++) {
-        LASSERT(v, syms->cell[i]->type == LVAL_SYM,
-            "'def' expects variable %i to be symbol", i);
+    LASSERT(v, v->count > 0, "No arguments passed to '%s'", lop_names[op]);
+
+    // Accumulate unboxed while the result fits a long, so only the final
+    // result allocates, and box it as big only once it doesn't
+    long x = 0;
+    struct lval* big = NULL;
+    int first = 1;
+    if (v->count == 1 && op == LOP_SUB) {
+        first = 0; // (- a) is (- 0 a)
+    } else if (v->cell[0]->type == LVAL_NUM) {
+        x = v->cell[0]->num;
+    } else {
+        big = lval_copy(v->cell[0]);
     }
 
-    LASSERT(v, syms->count == (v->count - 1),
-        "'def' expects same variable & value count. "
-        "Got %i variables and %i values.",
-        syms->count, v->count -1);
+    lop_arith fold = lop_arith_fns[op];
+    for (int i = first; i < v->count; i++) {
+        struct lval* b = v->cell[i];
+        if (big == NULL && b->type == LVAL_NUM) {
+            int ok = fold(&x, b->num);
+            if (ok > 0) continue;
+            if (ok < 0) {
+                lval_del(v);
+                return lval_err("Division by 0");
+            }
+        }
+
+        if (big == NULL) big = lval_num(x);
+        struct lval* r = lop_big(op, big, b);
+        lval_del(big);
+        big = NULL;
+        if (r->type == LVAL_ERR) {
+            lval_del(v);
+            return r;
+        }
+        if (r->type == LVAL_NUM) {
+            x = r->num;
+            lval_del(r);
+        } else {
+            big = r;
+        }
+    }
+
+    lval_del(v);
+
+    return big ? big : lval_num(x);
+}
+
+// Packed vectors keep their int64 elements contiguous, so the kernels
+// below stream through memory rather than chasing a pointer per number.
+// Each kernel has a portable scalar version, and lvec_init swaps in SSE4
+// or AVX2 ones at startup when the CPU has them. Elements are fixed at
+// 64 bits, so overflow is an error rather than a bignum.
+struct lvec_kernels {
+    char* name;
+    // r = a + b or a - b, returning whether any element overflowed
+    int (*add)(int64_t* r, int64_t* a, int64_t* b, int n);
+    int (*sub)(int64_t* r, int64_t* a, int64_t* b, int n);
+    // r = a > b or a == b as 0 or 1, flipped when invert is set
+    void (*gt)(int64_t* r, int64_t* a, int64_t* b, int n, int invert);
+    void (*eq)(int64_t* r, int64_t* a, int64_t* b, int n, int invert);
+    // *r = the sum of a, returning whether it overflowed
+    int (*sum)(int64_t* a, int n, int64_t* r);
+    // of n > 0 elements
+    int64_t (*min)(int64_t* a, int n);
+    int64_t (*max)(int64_t* a, int n);
+};
+
+// Two's complement sums overflow when the result's sign differs from
+// both operands', differences when it differs from a's and a and b differ
+#define LVEC_ADD_OVERFLOW(a, b, s) ((((a) ^ (s)) & ((b) ^ (s))) < 0)
+#define LVEC_SUB_OVERFLOW(a, b, s) ((((a) ^ (b)) & ((a) ^ (s))) < 0)
+
+int lvec_add_scalar(int64_t* r, int64_t* a, int64_t* b, int n) {
+    int overflow = 0;
+    for (int i = 0; i < n; i++) {
+        int64_t s = (int64_t) ((uint64_t) a[i] + (uint64_t) b[i]);
+        overflow |= LVEC_ADD_OVERFLOW(a[i], b[i], s);
+        r[i] = s;
+    }
+    return overflow;
+}
+
+int lvec_sub_scalar(int64_t* r, int64_t* a, int64_t* b, int n) {
+    int overflow = 0;
+    for (int i = 0; i < n; i++) {
+        int64_t s = (int64_t) ((uint64_t) a[i] - (uint64_t) b[i]);
+        overflow |= LVEC_SUB_OVERFLOW(a[i], b[i], s);
+        r[i] = s;
+    }
+    return overflow;
+}
+
+void lvec_gt_scalar(int64_t* r, int64_t* a, int64_t* b, int n, int invert) {
+    for (int i = 0; i < n; i++) r[i] = (a[i] > b[i]) ^ invert;
+}
+
+void lvec_eq_scalar(int64_t* r, int64_t* a, int64_t* b, int n, int invert) {
+    for (int i = 0; i < n; i++) r[i] = (a[i] == b[i]) ^ invert;
+}
+
+// Adds a to s, for the SIMD sums' leftover elements too
+int lvec_sum_from(int64_t s, int64_t* a, int n, int64_t* r) {
+    int overflow = 0;
+    for (int i = 0; i < n; i++) {
+        int64_t t = (int64_t) ((uint64_t) s + (uint64_t) a[i]);
+        overflow |= LVEC_ADD_OVERFLOW(s, a[i], t);
+        s = t;
+    }
+    *r = s;
+    return overflow;
+}
+
+int lvec_sum_scalar(int64_t* a, int n, int64_t* r) {
+    return lvec_sum_from(0, a, n, r);
+}
+
+int64_t lvec_min_scalar(int64_t* a, int n) {
+    int64_t m = a[0];
+    for (int i = 1; i < n; i++) if (a[i] < m) m = a[i];
+    return m;
+}
+
+int64_t lvec_max_scalar(int64_t* a, int n) {
+    int64_t m = a[0];
+    for (int i = 1; i < n; i++) if (a[i] > m) m = a[i];
+    return m;
+}
+
+struct lvec_kernels lvec_scalar = {
+    "scalar", lvec_add_scalar, lvec_sub_scalar, lvec_gt_scalar,
+    lvec_eq_scalar, lvec_sum_scalar, lvec_min_scalar, lvec_max_scalar
+};
+
+#ifdef LVEC_X86
+
+// The SSE and AVX2 kernels only differ in register width, so both are
+// stamped out from these templates. The sign bits of the overflow
+// accumulator mark the lanes that overflowed.
+#define LVEC_KERNELS(isa, arch, vec, w, p, load, store, movemask,         \
+        cmpgt, cmpeq, blend)                                                \
+__attribute__((target(arch)))                                             \
+int lvec_add_##isa(int64_t* r, int64_t* a, int64_t* b, int n) {             \
+    vec ov = p##_setzero_##w();                                             \
+    int i = 0;                                                              \
+    for (; i + (int) (sizeof(vec) / 8) <= n; i += sizeof(vec) / 8) {        \
+        vec x = load((vec*) (a + i)), y = load((vec*) (b + i));             \
+        vec s = p##_add_epi64(x, y);                                        \
+        ov = p##_or_##w(ov, p##_and_##w(p##_xor_##w(x, s),                  \
+            p##_xor_##w(y, s)));                                            \
+        store((vec*) (r + i), s);                                           \
+    }                                                                       \
+    return (movemask(ov) != 0)                                              \
+        | lvec_add_scalar(r + i, a + i, b + i, n - i);                      \
+}                                                                           \
+                                                                            \
+__attribute__((target(arch)))                                             \
+int lvec_sub_##isa(int64_t* r, int64_t* a, int64_t* b, int n) {             \
+    vec ov = p##_setzero_##w();                                             \
+    int i = 0;                                                              \
+    for (; i + (int) (sizeof(vec) / 8) <= n; i += sizeof(vec) / 8) {        \
+        vec x = load((vec*) (a + i)), y = load((vec*) (b + i));             \
+        vec s = p##_sub_epi64(x, y);                                        \
+        ov = p##_or_##w(ov, p##_and_##w(p##_xor_##w(x, y),                  \
+            p##_xor_##w(x, s)));                                            \
+        store((vec*) (r + i), s);                                           \
+    }                                                                       \
+    return (movemask(ov) != 0)                                              \
+        | lvec_sub_scalar(r + i, a + i, b + i, n - i);                      \
+}                                                                           \
+                                                                            \
+__attribute__((target(arch)))                                             \
+void lvec_gt_##isa(int64_t* r, int64_t* a, int64_t* b, int n, int invert) { \
+    vec one = p##_set1_epi64x(1);                                           \
+    vec flip = p##_set1_epi64x(invert);                                     \
+    int i = 0;                                                              \
+    for (; i + (int) (sizeof(vec) / 8) <= n; i += sizeof(vec) / 8) {        \
+        vec x = load((vec*) (a + i)), y = load((vec*) (b + i));             \
+        vec m = p##_and_##w(cmpgt(x, y), one);                              \
+        store((vec*) (r + i), p##_xor_##w(m, flip));                        \
+    }                                                                       \
+    lvec_gt_scalar(r + i, a + i, b + i, n - i, invert);                     \
+}                                                                           \
+                                                                            \
+__attribute__((target(arch)))                                             \
+void lvec_eq_##isa(int64_t* r, int64_t* a, int64_t* b, int n, int invert) { \
+    vec one = p##_set1_epi64x(1);                                           \
+    vec flip = p##_set1_epi64x(invert);                                     \
+    int i = 0;                                                              \
+    for (; i + (int) (sizeof(vec) / 8) <= n; i += sizeof(vec) / 8) {        \
+        vec x = load((vec*) (a + i)), y = load((vec*) (b + i));             \
+        vec m = p##_and_##w(cmpeq(x, y), one);                              \
+        store((vec*) (r + i), p##_xor_##w(m, flip));                        \
+    }                                                                       \
+    lvec_eq_scalar(r + i, a + i, b + i, n - i, invert);                     \
+}                                                                           \
+                                                                            \
+__attribute__((target(arch)))                                             \
+int lvec_sum_##isa(int64_t* a, int n, int64_t* r) {                         \
+    vec acc = p##_setzero_##w(), ov = p##_setzero_##w();                    \
+    int i = 0;                                                              \
+    for (; i + (int) (sizeof(vec) / 8) <= n; i += sizeof(vec) / 8) {        \
+        vec x = load((vec*) (a + i));                                       \
+        vec s = p##_add_epi64(acc, x);                                      \
+        ov = p##_or_##w(ov, p##_and_##w(p##_xor_##w(acc, s),                \
+            p##_xor_##w(x, s)));                                            \
+        acc = s;                                                            \
+    }                                                                       \
+    int64_t lanes[sizeof(vec) / 8];                                         \
+    store((vec*) lanes, acc);                                               \
+    int64_t s;                                                              \
+    int overflow = movemask(ov) != 0;                                       \
+    overflow |= lvec_sum_from(0, lanes, sizeof(vec) / 8, &s);               \
+    return overflow | lvec_sum_from(s, a + i, n - i, r);                    \
+}                                                                           \
+                                                                            \
+__attribute__((target(arch)))                                             \
+int64_t lvec_min_##isa(int64_t* a, int n) {                                 \
+    vec m = p##_set1_epi64x(a[0]);                                          \
+    int i = 0;                                                              \
+    for (; i + (int) (sizeof(vec) / 8) <= n; i += sizeof(vec) / 8) {        \
+        vec x = load((vec*) (a + i));                                       \
+        m = blend(m, x, cmpgt(m, x));                                       \
+    }                                                                       \
+    int64_t lanes[sizeof(vec) / 8];                                         \
+    store((vec*) lanes, m);                                                 \
+    int64_t r = lvec_min_scalar(lanes, sizeof(vec) / 8);                    \
+    if (i < n) {                                                            \
+        int64_t t = lvec_min_scalar(a + i, n - i);                          \
+        if (t < r) r = t;                                                   \
+    }                                                                       \
+    return r;                                                               \
+}                                                                           \
+                                                                            \
+__attribute__((target(arch)))                                             \
+int64_t lvec_max_##isa(int64_t* a, int n) {                                 \
+    vec m = p##_set1_epi64x(a[0]);                                          \
+    int i = 0;                                                              \
+    for (; i + (int) (sizeof(vec) / 8) <= n; i += sizeof(vec) / 8) {        \
+        vec x = load((vec*) (a + i));                                       \
+        m = blend(m, x, cmpgt(x, m));                                       \
+    }                                                                       \
+    int64_t lanes[sizeof(vec) / 8];                                         \
+    store((vec*) lanes, m);                                                 \
+    int64_t r = lvec_max_scalar(lanes, sizeof(vec) / 8);                    \
+    if (i < n) {                                                            \
+        int64_t t = lvec_max_scalar(a + i, n - i);                          \
+        if (t > r) r = t;                                                   \
+    }                                                                       \
+    return r;                                                               \
+}                                                                           \
+                                                                            \
+struct lvec_kernels lvec_##isa = {                                          \
+    #isa, lvec_add_##isa, lvec_sub_##isa, lvec_gt_##isa, lvec_eq_##isa,     \
+    lvec_sum_##isa, lvec_min_##isa, lvec_max_##isa                          \
+};
+
+#define LVEC_MOVEMASK128(x) _mm_movemask_pd(_mm_castsi128_pd(x))
+#define LVEC_MOVEMASK256(x) _mm256_movemask_pd(_mm256_castsi256_pd(x))
+
+LVEC_KERNELS(sse4, "sse4.2", __m128i, si128, _mm,
+    _mm_loadu_si128, _mm_storeu_si128, LVEC_MOVEMASK128,
+    _mm_cmpgt_epi64, _mm_cmpeq_epi64, _mm_blendv_epi8)
+
+LVEC_KERNELS(avx2, "avx2", __m256i, si256, _mm256,
+    _mm256_loadu_si256, _mm256_storeu_si256, LVEC_MOVEMASK256,
+    _mm256_cmpgt_epi64, _mm256_cmpeq_epi64, _mm256_blendv_epi8)
+
+#endif
+
+struct lvec_kernels lvec;
+
+void lvec_init(int simd) {
+    lvec = lvec_scalar;
+#ifdef LVEC_X86
+    if (!simd) return;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        lvec = lvec_avx2;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        lvec = lvec_sse4;
+    }
+#endif
+}
+
+// There is no SIMD 64-bit multiply or divide short of AVX-512, so these
+// stay scalar. lvec_div returns -1 on division by 0
+int lvec_mul(int64_t* r, int64_t* a, int64_t* b, int n) {
+    int overflow = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t x = a[i] < 0 ? -(uint64_t) a[i] : (uint64_t) a[i];
+        uint64_t y = b[i] < 0 ? -(uint64_t) b[i] : (uint64_t) b[i];
+        r[i] = (int64_t) ((uint64_t) a[i] * (uint64_t) b[i]);
+        int neg = (a[i] < 0) != (b[i] < 0);
+        if (x && y > (neg ? (uint64_t) INT64_MAX + 1 : INT64_MAX) / x) {
+            overflow = 1;
+        }
+    }
+    return overflow;
+}
+
+int lvec_div(int64_t* r, int64_t* a, int64_t* b, int n) {
+    for (int i = 0; i < n; i++) {
+        if (b[i] == 0) return -1;
+        if (b[i] == -1 && a[i] == INT64_MIN) return 1;
+        r[i] = a[i] / b[i];
+    }
+    return 0;
+}
+
+// The element-wise builtins. Each operand is a vector or a number, which
+// is spread across every element
+struct lval* lval_eval_vec(struct lenv* e, enum lop op, struct lval* v) {
+    char name[8];
+    snprintf(name, sizeof(name), "vec%s", lop_names[op]);
+    LNUMARGS(v, 2, name);
+
+    int n = -1;
+    for (int i = 0; i < 2; i++) {
+        struct lval* x = v->cell[i];
+        LASSERT(v, x->type == LVAL_VEC || x->type == LVAL_NUM,
+            "Wrong type for arg %i in '%s'. Got %s, expected %s",
+            i, name, lval_type_name(x->type), lval_type_name(LVAL_VEC));
+        if (x->type != LVAL_VEC) continue;
+        LASSERT(v, n < 0 || n == x->length,
+            "'%s' expects vectors of the same length. Got %i and %i",
+            name, n, x->length);
+        n = x->length;
+    }
+    LASSERT(v, n >= 0, "'%s' expects a vector", name);
+
+    struct lval* args[2];
+    for (int i = 0; i < 2; i++) {
+        struct lval* x = v->cell[i];
+        if (x->type == LVAL_VEC) {
+            args[i] = lval_copy(x);
+        } else {
+            args[i] = lval_vec(n);
+            for (int j = 0; j < n; j++) args[i]->items[j] = x->num;
+        }
+    }
+    int64_t* a = args[0]->items;
+    int64_t* b = args[1]->items;
+
+    struct lval* r = lval_vec(n);
+    int status = 0;
+    switch (op) {
+        case LOP_ADD: status = lvec.add(r->items, a, b, n); break;
+        case LOP_SUB: status = lvec.sub(r->items, a, b, n); break;
+        case LOP_MUL: status = lvec_mul(r->items, a, b, n); break;
+        case LOP_DIV: status = lvec_div(r->items, a, b, n); break;
+        case LOP_LT: lvec.gt(r->items, b, a, n, 0); break;
+        case LOP_LTE: lvec.gt(r->items, a, b, n, 1); break;
+        case LOP_GT: lvec.gt(r->items, a, b, n, 0); break;
+        case LOP_GTE: lvec.gt(r->items, b, a, n, 1); break;
+        case LOP_EQ: lvec.eq(r->items, a, b, n, 0); break;
+        case LOP_NEQ: lvec.eq(r->items, a, b, n, 1); break;
+        default: break;
+    }
+
+    lval_del(args[0]);
+    lval_del(args[1]);
+    lval_del(v);
+    if (status) {
+        lval_del(r);
+        return status < 0 ? lval_err("Division by 0")
+            : lval_err("Integer overflow in '%s'", name);
+    }
+    return r;
+}
+
+struct lval* lval_builtin_def(struct lenv* e, struct lval* v) {
+    LTYPE(v, LVAL_QEXP, 0, "def");
+
+    struct lval* syms = v->cell[0];
+
+    for (int i = 0; i < syms->count; i++) {
+        LASSERT(v, syms->cell[i]->type == LVAL_SYM,
+            "'def' expects variable %i to be symbol", i);
+    }
+
+    LASSERT(v, syms->count == (v->count - 1),
+        "'def' expects same variable & value count. "
+        "Got %i variables and %i values.",
+        syms->count, v->count -1);
 
     for (int i = 0; i < syms->count; i++) {
-        char* sym = syms->cell[i]->sym;
+        int sym = syms->cell[i]->sym;
         struct lval* x = lenv_get(e, sym);
         if (x->type == LVAL_FUN && x->fun_type == LVAL_FUN_BUILTIN) {
             struct lval* err = lval_err(
-                "Cannot redefine builtin function '%s'", sym);
+                "Cannot redefine builtin function '%s'", lsym_name(sym));
+            lval_del(x);
             lval_del(v);
             return err;
         }
+        lval_del(x);
 
         lenv_def(e, sym, v->cell[i + 1]);
     }
@@ -723,6 +2710,60 @@ struct lval* lval_builtin_def(struct lenv* e, struct lval* v) {
     return lval_take(v, 0);
 }
 
+// Give every symbol in v the lexical address of the parameter it names.
+// scopes holds the parameter lists of the enclosing lambdas, innermost
+// first, and nested lambda forms push their own. Symbols bound further
+// out keep the address an enclosing lambda gave them. Addresses are only
+// a lookup hint, so annotating a body that is shared is harmless
+#define LRES_MAX_DEPTH 32
+
+void lres_resolve(struct lval* v, struct lval** scopes, int n) {
+    switch (v->type) {
+        case LVAL_SYM:
+            // a name a lambda binds twice is its last slot, see lenv_get
+            for (int d = 0; d < n; d++) {
+                int slot = 0;
+                int found = 0;
+                for (int i = 0; i < scopes[d]->count; i++) {
+                    int sym = scopes[d]->cell[i]->sym;
+                    if (sym == lsym_amp) continue;
+                    if (sym == v->sym) {
+                        v->depth = d;
+                        v->slot = slot;
+                        found = 1;
+                    }
+                    slot++;
+                }
+                if (found) return;
+            }
+            break;
+        case LVAL_SEXP:
+        case LVAL_QEXP:
+            if (v->count == 3 && n < LRES_MAX_DEPTH
+                    && v->cell[0]->type == LVAL_SYM
+                    && v->cell[0]->sym == lsym_lambda
+                    && v->cell[1]->type == LVAL_QEXP
+                    && v->cell[2]->type == LVAL_QEXP) {
+                struct lval* inner[LRES_MAX_DEPTH];
+                inner[0] = v->cell[1];
+                for (int d = 0; d < n; d++) inner[d + 1] = scopes[d];
+                for (int i = 0; i < v->cell[1]->count; i++) {
+                    if (v->cell[1]->cell[i]->type != LVAL_SYM) return;
+                }
+                lres_resolve(v->cell[2], inner, n + 1);
+                return;
+            }
+            for (int i = 0; i < v->count; i++) {
+                lres_resolve(v->cell[i], scopes, n);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+struct lval* lfold_body(struct lval* body, struct lval* params);
+
 struct lval* lval_builtin_lambda(struct lenv* e, struct lval* v) {
     LNUMARGS(v, 2, "\\");
     LTYPE(v, LVAL_QEXP, 0, "\\");
@@ -733,26 +2774,58 @@ struct lval* lval_builtin_lambda(struct lenv* e, struct lval* v) {
         LASSERT(v, s->type == LVAL_SYM,
             "'\\' expects variable %i to be symbol", i);
 
-        if (strcmp(s->sym, "&") == 0) {
+        if (s->sym == lsym_amp) {
             LASSERT(v, v->cell[0]->count == i + 2,
                 "'\\' requires exactly one symbol after &");
         }
     }
 
-    struct lval* x = lval_lambda(lval_pop(v, 0), lval_pop(v, 0));
+    struct lval* args = lval_pop(v, 0);
+    struct lval* body = lval_pop(v, 0);
+    lres_resolve(body, &args, 1);
+    struct lval* folded = lfold_body(lval_copy(body), args);
+    if (folded == body) {
+        lval_del(folded);
+        folded = NULL;
+    }
+    struct lval* x = lval_lambda(args, body, folded);
     lval_del(v);
 
     return x;
 }
 
+void lenv_print_stats(struct lenv* e) {
+    long probes = 0;
+    int longest = 0;
+    for (int i = 0; i < e->cap; i++) {
+        if (e->syms[i] < 0) continue;
+        int home = LENV_HASH(e->syms[i], e->cap);
+        int probe = ((i - home) & (e->cap - 1)) + 1;
+        probes += probe;
+        if (probe > longest) longest = probe;
+    }
+    printf("%i/%i slots used, load factor %.2f\n",
+        e->count, e->cap, (double) e->count / e->cap);
+    printf("probe length avg %.2f, max %i\n",
+        e->count ? (double) probes / e->count : 0.0, longest);
+    printf("global lookups: %li cache hits, %li misses\n",
+        lenv_cache_hits, lenv_cache_misses);
+    printf("constant folding: %li calls folded\n", lfold_count);
+}
+
 struct lval* lval_builtin_env(struct lenv* e, struct lval* v) {
     LNUMARGS(v, 0, "env");
 
-    for (int i = 0; i < e->count; i++) {
-        printf("%s - ", e->syms[i]);
+    int n = e->cap ? e->cap : e->count;
+    for (int i = 0; i < n; i++) {
+        if (e->syms[i] < 0) continue;
+        printf("%s - ", lsym_name(e->syms[i]));
         lval_print(e->vals[i]);
         printf("\n");
     }
+    if (e->cap) {
+        lenv_print_stats(e);
+    }
 
     if (e->parent) {
         printf("parent:\n");
@@ -762,6 +2835,47 @@ struct lval* lval_builtin_env(struct lenv* e, struct lval* v) {
     return lval_sexp();
 }
 
+struct lval* lval_builtin_allocs(struct lenv* e, struct lval* v) {
+    LNUMARGS(v, 0, "allocs");
+    lval_del(v);
+
+    return lval_num(lval_allocs);
+}
+
+struct lval* lval_builtin_mem(struct lenv* e, struct lval* v) {
+    LNUMARGS(v, 0, "mem");
+
+    printf("lval: %li live, %li peak\n", lmem_lvals.live, lmem_lvals.peak);
+    for (int c = 0; c < LMEM_CLASSES; c++) {
+        struct lmem_pool* p = &lmem_classes[c];
+        if (p->peak == 0) continue;
+        printf("%lib: %li live, %li peak\n", (long) p->size, p->live, p->peak);
+    }
+    printf("%li chunks, %li large blocks malloc'd\n", lmem_chunks, lmem_large);
+
+    lval_del(v);
+    return lval_sexp();
+}
+
+struct lval* lval_builtin_gc(struct lenv* e, struct lval* v) {
+    LNUMARGS(v, 0, "gc");
+    lval_del(v);
+
+    lgc_collect(e);
+    long live = lmem_lvals.live + lgc_young_live();
+    printf("heap: %li lvals (%li bytes)\n",
+        live, live * (long) sizeof(struct lval));
+    printf("freed %li lvals in %.3fms, %li collections\n",
+        lgc_last.freed, lgc_last.pause, lgc_last.collections);
+    printf("nursery: %li/%li used, %li promoted\n",
+        (long) (lgc_young.next - lgc_young.start), lgc_young.size,
+        lgc_young.promoted);
+    printf("minor: %li collections, last %.3fms, total %.3fms\n",
+        lgc_young.minors, lgc_young.pause, lgc_young.total_pause);
+
+    return lval_sexp();
+}
+
 struct lval* lval_builtin_exit(struct lenv* e, struct lval* v) {
     LNUMARGS(v, 0, "exit");
 
@@ -769,55 +2883,196 @@ struct lval* lval_builtin_exit(struct lenv* e, struct lval* v) {
 }
 
 struct lval* lval_builtin_add(struct lenv* e, struct lval* v) {
-    return lval_eval_op(e, "+", v);
+    return lval_eval_op(e, LOP_ADD, v);
 }
 struct lval* lval_builtin_sub(struct lenv* e, struct lval* v) {
-    return lval_eval_op(e, "-", v);
+    return lval_eval_op(e, LOP_SUB, v);
 }
 struct lval* lval_builtin_mul(struct lenv* e, struct lval* v) {
-    return lval_eval_op(e, "*", v);
+    return lval_eval_op(e, LOP_MUL, v);
 }
 struct lval* lval_builtin_div(struct lenv* e, struct lval* v) {
-    return lval_eval_op(e, "/", v);
+    return lval_eval_op(e, LOP_DIV, v);
 }
 struct lval* lval_builtin_mod(struct lenv* e, struct lval* v) {
-    return lval_eval_op(e, "%", v);
+    return lval_eval_op(e, LOP_MOD, v);
 }
 struct lval* lval_builtin_pow(struct lenv* e, struct lval* v) {
-    return lval_eval_op(e, "^", v);
+    return lval_eval_op(e, LOP_POW, v);
 }
 struct lval* lval_builtin_min(struct lenv* e, struct lval* v) {
-    return lval_eval_op(e, "min", v);
+    return lval_eval_op(e, LOP_MIN, v);
 }
 struct lval* lval_builtin_max(struct lenv* e, struct lval* v) {
-    return lval_eval_op(e, "max", v);
+    return lval_eval_op(e, LOP_MAX, v);
 }
 
 struct lval* lval_builtin_not(struct lenv* e, struct lval* v) {
     LNUMARGS(v, 1, "not");
     LTYPE(v, LVAL_BOOL, 0, "not");
 
-    struct lval* x = lval_take(v, 0);
-    x->flag = !x->flag;
-    return x;
+    int flag = v->cell[0]->flag;
+    lval_del(v);
+    return lval_bool(!flag);
 }
 struct lval* lval_builtin_lt(struct lenv* e, struct lval* v) {
-    return lval_eval_comp(e, "<", v);
+    return lval_eval_comp(e, LOP_LT, v);
 }
 struct lval* lval_builtin_lte(struct lenv* e, struct lval* v) {
-    return lval_eval_comp(e, "<=", v);
+    return lval_eval_comp(e, LOP_LTE, v);
 }
 struct lval* lval_builtin_gt(struct lenv* e, struct lval* v) {
-    return lval_eval_comp(e, ">", v);
+    return lval_eval_comp(e, LOP_GT, v);
 }
 struct lval* lval_builtin_gte(struct lenv* e, struct lval* v) {
-    return lval_eval_comp(e, ">=", v);
+    return lval_eval_comp(e, LOP_GTE, v);
 }
 struct lval* lval_builtin_eq(struct lenv* e, struct lval* v) {
-    return lval_eval_comp(e, "=", v);
+    return lval_eval_comp(e, LOP_EQ, v);
 }
 struct lval* lval_builtin_neq(struct lenv* e, struct lval* v) {
-    return lval_eval_comp(e, "!=", v);
+    return lval_eval_comp(e, LOP_NEQ, v);
+}
+
+struct lval* lval_builtin_vec(struct lenv* e, struct lval* v) {
+    LNUMARGS(v, 1, "vec");
+    LTYPE(v, LVAL_QEXP, 0, "vec");
+
+    struct lval* q = v->cell[0];
+    for (int i = 0; i < q->count; i++) {
+        LASSERT(v, q->cell[i]->type == LVAL_NUM,
+            "'vec' expects element %i to be a 64-bit number", i);
+    }
+
+    struct lval* x = lval_vec(q->count);
+    for (int i = 0; i < q->count; i++) x->items[i] = q->cell[i]->num;
+    lval_del(v);
+    return x;
+}
+
+struct lval* lval_builtin_unvec(struct lenv* e, struct lval* v) {
+    LNUMARGS(v, 1, "unvec");
+    LTYPE(v, LVAL_VEC, 0, "unvec");
+
+    struct lval* x = v->cell[0];
+    struct lval* q = lval_qexp();
+    lval_cells_alloc(q, x->length);
+    for (int i = 0; i < x->length; i++) q->cell[i] = lval_num(x->items[i]);
+    lval_del(v);
+    return q;
+}
+
+struct lval* lval_builtin_vec_add(struct lenv* e, struct lval* v) {
+    return lval_eval_vec(e, LOP_ADD, v);
+}
+struct lval* lval_builtin_vec_sub(struct lenv* e, struct lval* v) {
+    return lval_eval_vec(e, LOP_SUB, v);
+}
+struct lval* lval_builtin_vec_mul(struct lenv* e, struct lval* v) {
+    return lval_eval_vec(e, LOP_MUL, v);
+}
+struct lval* lval_builtin_vec_div(struct lenv* e, struct lval* v) {
+    return lval_eval_vec(e, LOP_DIV, v);
+}
+struct lval* lval_builtin_vec_lt(struct lenv* e, struct lval* v) {
+    return lval_eval_vec(e, LOP_LT, v);
+}
+struct lval* lval_builtin_vec_lte(struct lenv* e, struct lval* v) {
+    return lval_eval_vec(e, LOP_LTE, v);
+}
+struct lval* lval_builtin_vec_gt(struct lenv* e, struct lval* v) {
+    return lval_eval_vec(e, LOP_GT, v);
+}
+struct lval* lval_builtin_vec_gte(struct lenv* e, struct lval* v) {
+    return lval_eval_vec(e, LOP_GTE, v);
+}
+struct lval* lval_builtin_vec_eq(struct lenv* e, struct lval* v) {
+    return lval_eval_vec(e, LOP_EQ, v);
+}
+struct lval* lval_builtin_vec_neq(struct lenv* e, struct lval* v) {
+    return lval_eval_vec(e, LOP_NEQ, v);
+}
+
+// Sums that overflow 64 bits are redone exactly with bignums
+struct lval* lval_builtin_vec_sum(struct lenv* e, struct lval* v) {
+    LNUMARGS(v, 1, "vec-sum");
+    LTYPE(v, LVAL_VEC, 0, "vec-sum");
+
+    struct lval* x = v->cell[0];
+    int64_t sum;
+    if (!lvec.sum(x->items, x->length, &sum)) {
+        lval_del(v);
+        return lval_num(sum);
+    }
+
+    struct lval* r = lval_num(0);
+    for (int i = 0; i < x->length; i++) {
+        struct lval* n = lval_num(x->items[i]);
+        struct lval* t = lbig_add(r, n, 0);
+        lval_del(n);
+        lval_del(r);
+        r = t;
+    }
+    lval_del(v);
+    return r;
+}
+
+struct lval* lval_builtin_vec_dot(struct lenv* e, struct lval* v) {
+    LNUMARGS(v, 2, "vec-dot");
+    LTYPE(v, LVAL_VEC, 0, "vec-dot");
+    LTYPE(v, LVAL_VEC, 1, "vec-dot");
+
+    struct lval* x = v->cell[0];
+    struct lval* y = v->cell[1];
+    LASSERT(v, x->length == y->length,
+        "'vec-dot' expects vectors of the same length. Got %i and %i",
+        x->length, y->length);
+
+    long dot = 0;
+    int i = 0;
+    for (; i < x->length; i++) {
+        long p;
+        if (LOP_MUL_OVERFLOW((long) x->items[i], (long) y->items[i], &p)
+                || LOP_ADD_OVERFLOW(dot, p, &dot)) {
+            break;
+        }
+    }
+
+    // Finish exactly with bignums from the first overflow on
+    struct lval* r = lval_num(dot);
+    for (; i < x->length; i++) {
+        struct lval* a = lval_num(x->items[i]);
+        struct lval* b = lval_num(y->items[i]);
+        struct lval* p = lbig_mul(a, b);
+        struct lval* t = lbig_add(r, p, 0);
+        lval_del(a);
+        lval_del(b);
+        lval_del(p);
+        lval_del(r);
+        r = t;
+    }
+    lval_del(v);
+    return r;
+}
+
+struct lval* lval_builtin_vec_min(struct lenv* e, struct lval* v) {
+    LNUMARGS(v, 1, "vec-min");
+    LTYPE(v, LVAL_VEC, 0, "vec-min");
+    LASSERT(v, v->cell[0]->length > 0, "'vec-min' expects a non-empty vector");
+
+    struct lval* x = lval_num(lvec.min(v->cell[0]->items, v->cell[0]->length));
+    lval_del(v);
+    return x;
+}
+
+struct lval* lval_builtin_vec_max(struct lenv* e, struct lval* v) {
+    LNUMARGS(v, 1, "vec-max");
+    LTYPE(v, LVAL_VEC, 0, "vec-max");
+    LASSERT(v, v->cell[0]->length > 0, "'vec-max' expects a non-empty vector");
+
+    struct lval* x = lval_num(lvec.max(v->cell[0]->items, v->cell[0]->length));
+    lval_del(v);
+    return x;
 }
 
 void lenv_add_builtins(struct lenv* e) {
@@ -845,125 +3100,1988 @@ void lenv_add_builtins(struct lenv* e) {
     lenv_add_builtin(e, "tail", lval_builtin_tail);
     lenv_add_builtin(e, "last", lval_builtin_last);
     lenv_add_builtin(e, "init", lval_builtin_init);
+    lenv_add_builtin(e, "slice", lval_builtin_slice);
     lenv_add_builtin(e, "join", lval_builtin_join);
     lenv_add_builtin(e, "cons", lval_builtin_cons);
     lenv_add_builtin(e, "len",  lval_builtin_len);
     lenv_add_builtin(e, "eval", lval_builtin_eval);
 
+    lenv_add_builtin(e, "vec", lval_builtin_vec);
+    lenv_add_builtin(e, "unvec", lval_builtin_unvec);
+    lenv_add_builtin(e, "vec+", lval_builtin_vec_add);
+    lenv_add_builtin(e, "vec-", lval_builtin_vec_sub);
+    lenv_add_builtin(e, "vec*", lval_builtin_vec_mul);
+    lenv_add_builtin(e, "vec/", lval_builtin_vec_div);
+    lenv_add_builtin(e, "vec<", lval_builtin_vec_lt);
+    lenv_add_builtin(e, "vec<=", lval_builtin_vec_lte);
+    lenv_add_builtin(e, "vec>", lval_builtin_vec_gt);
+    lenv_add_builtin(e, "vec>=", lval_builtin_vec_gte);
+    lenv_add_builtin(e, "vec=", lval_builtin_vec_eq);
+    lenv_add_builtin(e, "vec!=", lval_builtin_vec_neq);
+    lenv_add_builtin(e, "vec-sum", lval_builtin_vec_sum);
+    lenv_add_builtin(e, "vec-dot", lval_builtin_vec_dot);
+    lenv_add_builtin(e, "vec-min", lval_builtin_vec_min);
+    lenv_add_builtin(e, "vec-max", lval_builtin_vec_max);
+
     lenv_add_builtin(e, "if", lval_builtin_if);
 
     lenv_add_builtin(e, "def", lval_builtin_def);
     lenv_add_builtin(e, "env", lval_builtin_env);
+    lenv_add_builtin(e, "allocs", lval_builtin_allocs);
+    lenv_add_builtin(e, "mem", lval_builtin_mem);
+    lenv_add_builtin(e, "gc", lval_builtin_gc);
 
     lenv_add_builtin(e, "\\", lval_builtin_lambda);
 
     lenv_add_builtin(e, "exit", lval_builtin_exit);
 }
 
-struct lval* lval_eval_call(struct lenv* e, struct lval* f, struct lval* args) {
-    if (f->fun_type == LVAL_FUN_BUILTIN) {
-        return f->builtin(e, args);
-    }
+// Constant folding. A call to a pure builtin whose arguments are all
+// literals is evaluated once, when the expression is read or the lambda
+// holding it is made, and replaced by its result. Calls that fail are
+// left alone so the error still happens if and when they run. Builtins
+// can't be redefined, but a parameter can shadow one, so names bound by
+// the lambda or by any live frame are not folded. Scope is dynamic, so
+// a caller's frame can still shadow a builtin in a body made long
+// before. A lambda keeps its body as written beside the folded one,
+// and the names folded calls went through are marked in lsyms.folded;
+// while any live frame binds one of them the written body runs instead.
+
+lfunc lfold_pure[] = {
+    lval_builtin_add, lval_builtin_sub, lval_builtin_mul, lval_builtin_div,
+    lval_builtin_mod, lval_builtin_pow, lval_builtin_min, lval_builtin_max,
+    lval_builtin_lt, lval_builtin_lte, lval_builtin_gt, lval_builtin_gte,
+    lval_builtin_eq, lval_builtin_neq, lval_builtin_not,
+    lval_builtin_list, lval_builtin_head, lval_builtin_tail,
+    lval_builtin_last, lval_builtin_init, lval_builtin_len,
+    lval_builtin_join, lval_builtin_cons, NULL
+};
 
-    int given = args->count;
-    int total = f->args->count;
+int lfold_literal(struct lval* v) {
+    return v->type == LVAL_NUM || v->type == LVAL_BIG
+        || v->type == LVAL_BOOL || v->type == LVAL_QEXP;
+}
 
-    while (args->count) {
-        if (f->args->count == 0) {
-            lval_del(args);
-            return lval_err(
-                "Too many arguments. Got %i, expected %i.",
-                given, total
-            );
+// The builtin s names, if it surely names one where it runs
+lfunc lfold_builtin(struct lval* s, struct lval* params) {
+    if (s->type != LVAL_SYM || lsyms.locals[s->sym]) return NULL;
+    if (params) {
+        for (int i = 0; i < params->count; i++) {
+            if (params->cell[i]->sym == s->sym) return NULL;
         }
+    }
+    int i = lenv_slot(lenv_globals, s->sym);
+    if (lenv_globals->syms[i] != s->sym) return NULL;
+    struct lval* f = lenv_globals->vals[i];
+    if (f->type != LVAL_FUN || f->fun_type != LVAL_FUN_BUILTIN) return NULL;
+    return f->builtin;
+}
 
-        struct lval* sym = lval_pop(f->args, 0);
-
-        if (strcmp(sym->sym, "&") == 0) {
-            // varargs
-            lval_del(sym);
-            sym = lval_pop(f->args, 0);
-            lenv_put(f->env, sym->sym, lval_builtin_list(e, args));
-            lval_del(sym);
-            break;
-        }
+// Notes that a lambda body relies on sym still naming its builtin
+void lfold_rely(int sym) {
+    if (lsyms.folded[sym]) return;
+    lsyms.folded[sym] = 1;
+    lfold_shadowed += lsyms.locals[sym];
+}
 
-        struct lval* val = lval_pop(args, 0);
-        lenv_put(f->env, sym->sym, val);
+// The value of running v as a call, or NULL if it can't be folded. Only
+// a lambda body being folded has params
+struct lval* lfold_call(struct lval* v, struct lval* params) {
+    if (v->count == 0) return NULL;
+    lfunc f = lfold_builtin(v->cell[0], params);
+    int pure = 0;
+    for (int i = 0; f && lfold_pure[i]; i++) {
+        if (lfold_pure[i] == f) pure = 1;
+    }
+    if (!pure) return NULL;
+    for (int i = 1; i < v->count; i++) {
+        if (!lfold_literal(v->cell[i])) return NULL;
+    }
 
-        lval_del(sym);
-        lval_del(val);
+    struct lval* args = lval_sexp();
+    for (int i = 1; i < v->count; i++) {
+        lval_add(args, lval_copy(v->cell[i]));
+    }
+    struct lval* r = f(lenv_globals, args);
+    if (!lfold_literal(r)) {
+        lval_del(r);
+        return NULL;
     }
+    if (params) lfold_rely(v->cell[0]->sym);
+    lfold_count++;
+    return r;
+}
 
-    lval_del(args);
+struct lval* lfold_code(struct lval* v, struct lval* params);
+struct lval* lfold_body(struct lval* body, struct lval* params);
 
-    if (f->args->count > 0) {
-        if (strcmp(f->args->cell[0]->sym, "&") != 0) {
-            return lval_copy(f);
+// Folds the code inside v, which runs as an sexp whatever its tag. Gives
+// back a copy with the folded parts replaced, or NULL if nothing folded
+struct lval* lfold_cells(struct lval* v, struct lval* params) {
+    struct lval* x = NULL;
+    int branches = v->count > 0
+        && lfold_builtin(v->cell[0], params) == lval_builtin_if;
+
+    for (int i = 0; i < v->count; i++) {
+        struct lval* r = NULL;
+        if (v->cell[i]->type == LVAL_SEXP) {
+            r = lfold_code(v->cell[i], params);
+        } else if (branches && i >= 2 && v->cell[i]->type == LVAL_QEXP) {
+            lval_copy(v->cell[i]);
+            r = lfold_body(v->cell[i], params);
+            if (r == v->cell[i]) {
+                lval_del(r);
+                r = NULL;
+            } else if (params) {
+                // the branch is only code while if is the builtin
+                lfold_rely(v->cell[0]->sym);
+            }
+        }
+        if (r) {
+            if (x == NULL) x = lval_clone(v);
+            lval_del(x->cell[i]);
+            x->cell[i] = r;
         }
-        // Got all args except varargs, so produce empty list
-        struct lval* val = lval_qexp();
-        lenv_put(f->env, f->args->cell[1]->sym, val);
-        lval_del(val);
     }
+    return x;
+}
 
-    f->env->parent = e;
+// Folded replacement for an expression in evaluated position, or NULL
+struct lval* lfold_code(struct lval* v, struct lval* params) {
+    struct lval* x = lfold_cells(v, params);
+    struct lval* r = lfold_call(x ? x : v, params);
+    if (r) {
+        if (x) lval_del(x);
+        return r;
+    }
+    return x;
+}
 
-    struct lval* sexp = lval_sexp();
-    lval_add(sexp, lval_copy(f->body));
+// Fold a freshly read expression
+struct lval* lfold_expr(struct lval* v) {
+    if (v->type != LVAL_SEXP) return v;
+    struct lval* r = lfold_code(v, NULL);
+    if (r == NULL) return v;
+    lval_del(v);
+    return r;
+}
 
-    return lval_builtin_eval(f->env, sexp);
+// Fold the calls inside a lambda body or if branch. The body itself is
+// left as a call, since a lone constant is not a valid sexp
+struct lval* lfold_body(struct lval* body, struct lval* params) {
+    struct lval* x = lfold_cells(body, params);
+    if (x == NULL) return body;
+    lval_del(body);
+    return x;
 }
 
-struct lval* lval_eval_sexp(struct lenv* e, struct lval* v) {
+// Bytecode for lambda bodies, compiled once when the lambda is made.
+// Each instruction is an opcode word and an operand word. The VM keeps
+// its operand stack on the collector's shadow stack, so values in
+// flight stay rooted across nested calls. With GCC or clang opcodes are
+// replaced by label addresses for direct-threaded dispatch.
+#ifdef __GNUC__
+    #define LVM_THREADED
+#endif
 
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
-    }
+enum lvm_op {
+    LVM_CONST, LVM_LOAD, LVM_APPLY, LVM_TAIL, LVM_FORM, LVM_TAIL_FORM,
+    LVM_OPS
+};
 
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) {
-            return lval_take(v, i);
-        }
+union lvm_word {
+    int op;
+    void* label;
+    int arg;
+    struct lval* val; // borrowed from the lambda body
+};
+
+struct lcode {
+    int refs;
+    int count;
+    int cap;
+    union lvm_word* words;
+};
+
+void** lvm_labels = NULL;
+
+struct lcode* lcode_copy(struct lcode* code) {
+    code->refs++;
+    return code;
+}
+
+void lcode_del(struct lcode* code) {
+    if (--code->refs > 0) return;
+    lmem_free(code->words, sizeof(union lvm_word) * code->cap);
+    lmem_free(code, sizeof(struct lcode));
+}
+
+void lvm_emit(struct lcode* code, int op, union lvm_word arg) {
+    if (code->count + 2 > code->cap) {
+        int cap = code->cap ? code->cap * 2 : 16;
+        code->words = lmem_realloc(code->words,
+            sizeof(union lvm_word) * code->cap, sizeof(union lvm_word) * cap);
+        code->cap = cap;
     }
+    code->words[code->count++].op = op;
+    code->words[code->count++] = arg;
+}
 
-    if (v->count == 0) return v;
+// An if form, which the tree evaluator also only recognises by name
+int lvm_is_form(struct lval* v) {
+    return v->count > 0 && v->cell[0]->type == LVAL_SYM
+        && v->cell[0]->sym == lsym_if;
+}
 
-    struct lval* f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
-        struct lval* err = lval_err(
-            "Expected sexp to begin with %s, got %s",
-            lval_type_name(LVAL_FUN), lval_type_name(f->type));
-        lval_del(f);
-        lval_del(v);
-        return err;
+void lvm_compile_expr(struct lcode* code, struct lval* v) {
+    union lvm_word arg;
+    switch (v->type) {
+        case LVAL_SYM:
+            arg.val = v;
+            lvm_emit(code, LVM_LOAD, arg);
+            break;
+        case LVAL_SEXP:
+            if (lvm_is_form(v)) {
+                arg.val = v;
+                lvm_emit(code, LVM_FORM, arg);
+                break;
+            }
+            for (int i = 0; i < v->count; i++) {
+                lvm_compile_expr(code, v->cell[i]);
+            }
+            arg.arg = v->count;
+            lvm_emit(code, LVM_APPLY, arg);
+            break;
+        default:
+            arg.val = v;
+            lvm_emit(code, LVM_CONST, arg);
+            break;
     }
-    struct lval* result = lval_eval_call(e, f, v);
-    lval_del(f);
-    return result;
 }
 
-struct lval* lval_eval(struct lenv* e, struct lval* v) {
-    if (v->type == LVAL_SYM) {
-        struct lval* x = lenv_get(e, v->sym);
-        lval_del(v);
-        return x;
+struct lval* lvm_exec(struct lenv* e, struct lcode* code);
+
+// The body is a qexp, run as an sexp just like the eval builtin would
+struct lcode* lvm_compile(struct lval* body) {
+    struct lcode* code = lmem_alloc(sizeof(struct lcode));
+    code->refs = 1;
+    code->count = 0;
+    code->cap = 0;
+    code->words = NULL;
+
+    union lvm_word arg;
+    if (lvm_is_form(body)) {
+        arg.val = body;
+        lvm_emit(code, LVM_TAIL_FORM, arg);
+    } else {
+        for (int i = 0; i < body->count; i++) {
+            lvm_compile_expr(code, body->cell[i]);
+        }
+        arg.arg = body->count;
+        lvm_emit(code, LVM_TAIL, arg);
     }
-    if (v->type == LVAL_SEXP) {
-        return lval_eval_sexp(e, v);
+
+#ifdef LVM_THREADED
+    if (lvm_labels == NULL) lvm_exec(NULL, NULL);
+    for (int i = 0; i < code->count; i += 2) {
+        code->words[i].label = lvm_labels[code->words[i].op];
     }
-    return v;
+#endif
+    return code;
 }
 
-int main(int argc, char** argv)
-{
-    mpc_parser_t* Bool = mpc_new("bool");
+struct lval* lval_eval_apply(struct lenv* e, struct lval* v);
+
+struct lval* lvm_exec(struct lenv* e, struct lcode* code) {
+#ifdef LVM_THREADED
+    static void* labels[LVM_OPS] = {
+        &&op_LVM_CONST, &&op_LVM_LOAD, &&op_LVM_APPLY, &&op_LVM_TAIL,
+        &&op_LVM_FORM, &&op_LVM_TAIL_FORM
+    };
+    if (code == NULL) {
+        lvm_labels = labels;
+        return NULL;
+    }
+    #define LVM_CASE(op) op_##op:
+    #define LVM_NEXT() goto *(pc++)->label
+#else
+    #define LVM_CASE(op) case op:
+    #define LVM_NEXT() continue
+#endif
+
+    union lvm_word* pc = code->words;
+    struct lval* x;
+    int n;
+
+    #define LVM_ARGS()                                              \
+        n = (pc++)->arg;                                            \
+        x = lval_sexp();                                            \
+        lval_cells_alloc(x, n);                                     \
+        lgc_roots.count -= n;                                       \
+        for (int i = 0; i < n; i++) {                               \
+            x->cell[i] = lgc_roots.vals[lgc_roots.count + i];       \
+        }
+
+#ifdef LVM_THREADED
+    LVM_NEXT();
+#else
+    for (;;) switch ((pc++)->op) {
+#endif
+
+    LVM_CASE(LVM_CONST)
+        LGC_PUSH(lval_copy((pc++)->val));
+        LVM_NEXT();
+
+    LVM_CASE(LVM_LOAD)
+        LGC_PUSH(lenv_get_sym(e, (pc++)->val));
+        LVM_NEXT();
+
+    LVM_CASE(LVM_APPLY)
+        LVM_ARGS();
+        LGC_PUSH(ltail_run(lval_eval_apply(e, x)));
+        LVM_NEXT();
+
+    // The final apply is in tail position, so hand it back to ltail_run
+    LVM_CASE(LVM_TAIL)
+        LVM_ARGS();
+        return lval_eval_apply(e, x);
+
+    // if forms decide what to evaluate as they go, so the tree evaluator
+    // runs them
+    LVM_CASE(LVM_FORM)
+        LGC_PUSH(ltail_run(lval_eval_sexp(e, (pc++)->val)));
+        LVM_NEXT();
+
+    LVM_CASE(LVM_TAIL_FORM)
+        return lval_eval_sexp(e, (pc++)->val);
+
+#ifndef LVM_THREADED
+        default: return lval_err("Bad opcode");
+    }
+#endif
+
+    #undef LVM_ARGS
+    #undef LVM_CASE
+    #undef LVM_NEXT
+}
+
+// Baseline JIT. Every lambda counts its calls, and once it has been
+// called LJIT_THRESHOLD times its body is compiled, if it can be, to
+// x86-64 machine code working on unboxed fixnums. Only bodies made of
+// number and boolean literals, the lambda's own parameters, arithmetic,
+// comparisons, not, id, if and calls to the lambda itself qualify; the
+// rest stay interpreted. Native code runs only while its assumptions
+// hold: every argument is a number, none of the names it relies on is
+// bound by a live frame, and each name it calls compiled code through
+// is still bound to that code. Anything the code can't finish, such as
+// division by zero or a result too big for a fixnum, raises ljit_bail
+// and the call is rerun by the interpreter, which is safe since the
+// code has no side effects. The rerun stays interpreted, tail calls and
+// all, until the ltail_run carrying it out returns; otherwise each step
+// of a tail loop ending in an error would run the rest of the loop
+// natively only to bail again.
+#define LJIT_THRESHOLD 64
+#define LJIT_MAX_SYMS 16
+
+enum ljit_state { LJIT_COLD, LJIT_NATIVE, LJIT_FAILED };
+
+struct ljit {
+    int refs;
+    long id;
+    int calls;
+    enum ljit_state state;
+    int nparams;
+    enum lval_type ret; // LVAL_NUM or LVAL_BOOL
+    int nsyms;
+    int syms[LJIT_MAX_SYMS]; // names that must not be shadowed
+    long targets[LJIT_MAX_SYMS]; // id of the code each is bound to, or 0
+    long (*fn)(long* args);
+    void* mem;
+    size_t size;
+    int rerun; // depth of the ltail_run rerunning a bailed call, or 0
+    struct ljit* next_rerun;
+};
+
+struct {
+    long compiled;
+    long failed;
+    long calls;
+    long bailouts;
+} ljit_stats = { 0, 0, 0, 0 };
+
+char ljit_bail = 0;
+long ljit_serial = 0;
+
+struct ljit* ljit_new(void) {
+    struct ljit* jit = lmem_alloc(sizeof(struct ljit));
+    jit->refs = 1;
+    jit->id = ++ljit_serial;
+    jit->calls = 0;
+    jit->nsyms = 0;
+    jit->state = LJIT_COLD;
+    jit->fn = NULL;
+    jit->mem = NULL;
+    jit->rerun = 0;
+    jit->next_rerun = NULL;
+    return jit;
+}
+
+struct ljit* ljit_copy(struct ljit* jit) {
+    jit->refs++;
+    return jit;
+}
+
+void ljit_del(struct ljit* jit) {
+    if (--jit->refs > 0) return;
+#ifdef LJIT_X86_64
+    if (jit->mem) munmap(jit->mem, jit->size);
+#endif
+    lmem_free(jit, sizeof(struct ljit));
+}
+
+void ljit_print_stats(void) {
+    printf("jit: %li compiled, %li rejected, %li native calls, "
+        "%li bailouts\n", ljit_stats.compiled, ljit_stats.failed,
+        ljit_stats.calls, ljit_stats.bailouts);
+}
+
+#ifdef LJIT_X86_64
+
+struct ljit_asm {
+    unsigned char* code;
+    int count;
+    int cap;
+    int depth; // words pushed since the body started
+    int entry; // where calls to self go
+    int start; // where tail calls to self go
+    struct ljit* jit;
+    struct lval* params;
+    enum lval_type ret;
+};
+
+void ljit_emit(struct ljit_asm* a, int n, ...) {
+    if (a->count + n > a->cap) {
+        int cap = a->cap ? a->cap * 2 : 256;
+        while (cap < a->count + n) cap *= 2;
+        a->code = lmem_realloc(a->code, a->cap, cap);
+        a->cap = cap;
+    }
+    va_list bytes;
+    va_start(bytes, n);
+    for (int i = 0; i < n; i++) {
+        a->code[a->count++] = va_arg(bytes, int);
+    }
+    va_end(bytes);
+}
+
+void ljit_emit32(struct ljit_asm* a, int x) {
+    ljit_emit(a, 4, x & 0xff, (x >> 8) & 0xff, (x >> 16) & 0xff,
+        (x >> 24) & 0xff);
+}
+
+void ljit_emit64(struct ljit_asm* a, long x) {
+    ljit_emit32(a, (int) x);
+    ljit_emit32(a, (int) (x >> 32));
+}
+
+void ljit_patch32(struct ljit_asm* a, int at, int x) {
+    for (int i = 0; i < 4; i++) a->code[at + i] = (x >> (8 * i)) & 0xff;
+}
+
+// rel32 jump or call to a known offset
+void ljit_jump(struct ljit_asm* a, int opcode, int target) {
+    ljit_emit(a, 1, opcode);
+    ljit_emit32(a, target - (a->count + 4));
+}
+
+void ljit_push(struct ljit_asm* a) { ljit_emit(a, 1, 0x50); a->depth++; }
+void ljit_pop_rax(struct ljit_asm* a) { ljit_emit(a, 1, 0x58); a->depth--; }
+void ljit_pop_rcx(struct ljit_asm* a) { ljit_emit(a, 1, 0x59); a->depth--; }
+
+// Set ljit_bail and leave through the bail stub at offset 5
+void ljit_emit_bail(struct ljit_asm* a) {
+    ljit_emit(a, 2, 0x48, 0xba); ljit_emit64(a, (long) &ljit_bail);
+    ljit_emit(a, 3, 0xc6, 0x02, 0x01);     // mov byte [rdx], 1
+    ljit_jump(a, 0xe9, 5);
+}
+
+// Bails if the last instruction overflowed, so the interpreter redoes
+// the call with bignums
+void ljit_emit_overflow(struct ljit_asm* a) {
+    ljit_emit(a, 2, 0x71, 0x00);           // jno over
+    int skip = a->count;
+    ljit_emit_bail(a);
+    a->code[skip - 1] = a->count - skip;
+}
+
+int ljit_param(struct ljit_asm* a, int sym) {
+    for (int i = a->params->count - 1; i >= 0; i--) {
+        if (a->params->cell[i]->sym == sym) return i;
+    }
+    return -1;
+}
+
+int ljit_note_sym(struct ljit* jit, int sym, long target) {
+    for (int i = 0; i < jit->nsyms; i++) {
+        if (jit->syms[i] == sym) return jit->targets[i] == target;
+    }
+    if (jit->nsyms == LJIT_MAX_SYMS) return 0;
+    jit->syms[jit->nsyms] = sym;
+    jit->targets[jit->nsyms++] = target;
+    return 1;
+}
+
+enum lval_type ljit_call_expr(struct ljit_asm* a, struct lval* v, int tail);
+
+// Compiles v to leave its value in rax. Returns its type, or LVAL_ERR
+// if v is outside what the JIT handles
+enum lval_type ljit_expr(struct ljit_asm* a, struct lval* v, int tail) {
+    switch (v->type) {
+        case LVAL_NUM:
+        case LVAL_BOOL:
+            ljit_emit(a, 2, 0x48, 0xb8);   // mov rax, imm64
+            ljit_emit64(a, v->type == LVAL_NUM ? v->num : v->flag);
+            return v->type;
+        case LVAL_SYM: {
+            int i = ljit_param(a, v->sym);
+            if (i < 0) return LVAL_ERR;
+            ljit_emit(a, 3, 0x48, 0x8b, 0x85); // mov rax, [rbp - 8(i+1)]
+            ljit_emit32(a, -8 * (i + 1));
+            return LVAL_NUM;
+        }
+        case LVAL_SEXP:
+            return ljit_call_expr(a, v, tail);
+        default:
+            return LVAL_ERR;
+    }
+}
+
+// Compiles the operands from 1 on, checking each has type t, and leaves
+// the first in rax and the second in rcx if there is one
+int ljit_operands(struct ljit_asm* a, struct lval* v, enum lval_type t) {
+    for (int i = v->count - 1; i >= 1; i--) {
+        if (ljit_expr(a, v->cell[i], 0) != t) return 0;
+        if (i > 1) ljit_push(a);
+    }
+    if (v->count > 2) ljit_pop_rcx(a);
+    return 1;
+}
+
+enum lval_type ljit_call_expr(struct ljit_asm* a, struct lval* v, int tail) {
+    if (v->count == 0 || v->cell[0]->type != LVAL_SYM) return LVAL_ERR;
+
+    int sym = v->cell[0]->sym;
+    int argc = v->count - 1;
+    if (ljit_param(a, sym) >= 0) return LVAL_ERR;
+    int slot = lenv_slot(lenv_globals, sym);
+    if (lenv_globals->syms[slot] != sym) return LVAL_ERR;
+    struct lval* f = lenv_globals->vals[slot];
+    if (f->type != LVAL_FUN) return LVAL_ERR;
+
+    if (f->fun_type == LVAL_FUN_LAMBDA) {
+        if (f->jit != a->jit || argc != a->params->count) return LVAL_ERR;
+        if (!ljit_note_sym(a->jit, sym, a->jit->id)) return LVAL_ERR;
+
+        if (tail) {
+            // Evaluate the new arguments, then overwrite the parameters
+            for (int i = 1; i < v->count; i++) {
+                if (ljit_expr(a, v->cell[i], 0) != LVAL_NUM) return LVAL_ERR;
+                ljit_push(a);
+            }
+            for (int i = argc - 1; i >= 0; i--) {
+                ljit_pop_rax(a);
+                ljit_emit(a, 3, 0x48, 0x89, 0x85); // mov [rbp - 8(i+1)], rax
+                ljit_emit32(a, -8 * (i + 1));
+            }
+            ljit_jump(a, 0xe9, a->start);
+            return a->ret;
+        }
+
+        // Push the arguments last to first so they sit in order in memory,
+        // pass their address, and keep the stack 16 byte aligned
+        for (int i = v->count - 1; i >= 1; i--) {
+            if (ljit_expr(a, v->cell[i], 0) != LVAL_NUM) return LVAL_ERR;
+            ljit_push(a);
+        }
+        int pad = a->depth % 2;
+        ljit_emit(a, 3, 0x48, 0x89, 0xe7);         // mov rdi, rsp
+        if (pad) ljit_emit(a, 4, 0x48, 0x83, 0xec, 0x08); // sub rsp, 8
+        ljit_jump(a, 0xe8, a->entry);
+        ljit_emit(a, 3, 0x48, 0x81, 0xc4);         // add rsp, imm32
+        ljit_emit32(a, 8 * (argc + pad));
+        a->depth -= argc;
+        ljit_emit(a, 2, 0x48, 0xba); ljit_emit64(a, (long) &ljit_bail);
+        ljit_emit(a, 3, 0x80, 0x3a, 0x00);         // cmp byte [rdx], 0
+        ljit_emit(a, 2, 0x0f, 0x85);               // jne bail stub
+        ljit_emit32(a, 5 - (a->count + 4));
+        return a->ret;
+    }
+
+    lfunc fn = f->builtin;
+    if (!ljit_note_sym(a->jit, sym, 0)) return LVAL_ERR;
+
+    if (fn == lval_builtin_id) {
+        if (argc != 1) return LVAL_ERR;
+        return ljit_expr(a, v->cell[1], tail);
+    }
+
+    if (fn == lval_builtin_if) {
+        if (argc != 3 || v->cell[2]->type != LVAL_QEXP
+                || v->cell[3]->type != LVAL_QEXP) {
+            return LVAL_ERR;
+        }
+        if (ljit_expr(a, v->cell[1], 0) != LVAL_BOOL) return LVAL_ERR;
+        ljit_emit(a, 3, 0x48, 0x85, 0xc0);         // test rax, rax
+        ljit_emit(a, 2, 0x0f, 0x84);               // je else
+        int to_else = a->count;
+        ljit_emit32(a, 0);
+        enum lval_type t = ljit_call_expr(a, v->cell[2], tail);
+        ljit_emit(a, 1, 0xe9);                     // jmp end
+        int to_end = a->count;
+        ljit_emit32(a, 0);
+        ljit_patch32(a, to_else, a->count - (to_else + 4));
+        if (t == LVAL_ERR || ljit_call_expr(a, v->cell[3], tail) != t) {
+            return LVAL_ERR;
+        }
+        ljit_patch32(a, to_end, a->count - (to_end + 4));
+        return t;
+    }
+
+    if (fn == lval_builtin_not) {
+        if (argc != 1 || ljit_expr(a, v->cell[1], 0) != LVAL_BOOL) {
+            return LVAL_ERR;
+        }
+        ljit_emit(a, 3, 0x83, 0xf0, 0x01);         // xor eax, 1
+        return LVAL_BOOL;
+    }
+
+    // Comparisons of two numbers
+    int cc = 0;
+    if (fn == lval_builtin_lt) cc = 0x9c;
+    if (fn == lval_builtin_lte) cc = 0x9e;
+    if (fn == lval_builtin_gt) cc = 0x9f;
+    if (fn == lval_builtin_gte) cc = 0x9d;
+    if (fn == lval_builtin_eq) cc = 0x94;
+    if (fn == lval_builtin_neq) cc = 0x95;
+    if (cc) {
+        if (argc != 2 || !ljit_operands(a, v, LVAL_NUM)) return LVAL_ERR;
+        ljit_emit(a, 3, 0x48, 0x39, 0xc8);         // cmp rax, rcx
+        ljit_emit(a, 3, 0x0f, cc, 0xc0);           // setcc al
+        ljit_emit(a, 3, 0x0f, 0xb6, 0xc0);         // movzx eax, al
+        return LVAL_BOOL;
+    }
+
+    // Arithmetic folds its operands left to right
+    if (fn != lval_builtin_add && fn != lval_builtin_sub
+            && fn != lval_builtin_mul && fn != lval_builtin_div
+            && fn != lval_builtin_mod && fn != lval_builtin_min
+            && fn != lval_builtin_max) {
+        return LVAL_ERR;
+    }
+    if (argc == 0) return LVAL_ERR;
+    if (ljit_expr(a, v->cell[1], 0) != LVAL_NUM) return LVAL_ERR;
+    if (argc == 1 && fn == lval_builtin_sub) {
+        ljit_emit(a, 3, 0x48, 0xf7, 0xd8);         // neg rax
+        ljit_emit_overflow(a);
+    }
+    for (int i = 2; i < v->count; i++) {
+        ljit_push(a);
+        if (ljit_expr(a, v->cell[i], 0) != LVAL_NUM) return LVAL_ERR;
+        ljit_emit(a, 3, 0x48, 0x89, 0xc1);         // mov rcx, rax
+        ljit_pop_rax(a);
+        if (fn == lval_builtin_add) ljit_emit(a, 3, 0x48, 0x01, 0xc8);
+        if (fn == lval_builtin_sub) ljit_emit(a, 3, 0x48, 0x29, 0xc8);
+        if (fn == lval_builtin_mul) ljit_emit(a, 4, 0x48, 0x0f, 0xaf, 0xc1);
+        if (fn == lval_builtin_add || fn == lval_builtin_sub
+                || fn == lval_builtin_mul) {
+            ljit_emit_overflow(a);
+        }
+        if (fn == lval_builtin_min) {
+            ljit_emit(a, 3, 0x48, 0x39, 0xc8);     // cmp rax, rcx
+            ljit_emit(a, 4, 0x48, 0x0f, 0x4f, 0xc1); // cmovg rax, rcx
+        }
+        if (fn == lval_builtin_max) {
+            ljit_emit(a, 3, 0x48, 0x39, 0xc8);     // cmp rax, rcx
+            ljit_emit(a, 4, 0x48, 0x0f, 0x4c, 0xc1); // cmovl rax, rcx
+        }
+        if (fn == lval_builtin_div || fn == lval_builtin_mod) {
+            ljit_emit(a, 3, 0x48, 0x85, 0xc9);     // test rcx, rcx
+            ljit_emit(a, 2, 0x75, 0x00);           // jnz divide
+            int skip = a->count;
+            ljit_emit_bail(a);
+            a->code[skip - 1] = a->count - skip;
+            // x / -1 traps on LONG_MIN, so negate instead
+            ljit_emit(a, 4, 0x48, 0x83, 0xf9, 0xff); // cmp rcx, -1
+            ljit_emit(a, 2, 0x75, 0x00);           // jne idiv
+            skip = a->count;
+            if (fn == lval_builtin_div) {
+                ljit_emit(a, 3, 0x48, 0xf7, 0xd8); // neg rax
+                ljit_emit_overflow(a);
+            } else {
+                ljit_emit(a, 2, 0x31, 0xc0);       // xor eax, eax
+            }
+            ljit_emit(a, 2, 0xeb, 0x00);           // jmp done
+            int done = a->count;
+            a->code[skip - 1] = a->count - skip;
+            ljit_emit(a, 2, 0x48, 0x99);           // cqo
+            ljit_emit(a, 3, 0x48, 0xf7, 0xf9);     // idiv rcx
+            if (fn == lval_builtin_mod) {
+                ljit_emit(a, 3, 0x48, 0x89, 0xd0); // mov rax, rdx
+            }
+            a->code[done - 1] = a->count - done;
+        }
+    }
+    return LVAL_NUM;
+}
+
+// Compiles f's body as returning ret, or fails
+int ljit_assemble(struct ljit_asm* a, struct lval* f, enum lval_type ret) {
+    int n = a->params->count;
+    int frame = 8 * (n + n % 2);
+
+    a->count = 0;
+    a->depth = 0;
+    a->ret = ret;
+    a->jit->nsyms = 0;
+
+    ljit_emit(a, 5, 0xe9, 0x02, 0x00, 0x00, 0x00); // jmp entry
+    ljit_emit(a, 2, 0xc9, 0xc3);                   // bail: leave; ret
+    a->entry = a->count;
+    ljit_emit(a, 4, 0x55, 0x48, 0x89, 0xe5);       // push rbp; mov rbp, rsp
+    ljit_emit(a, 3, 0x48, 0x81, 0xec);             // sub rsp, frame
+    ljit_emit32(a, frame);
+    for (int i = 0; i < n; i++) {
+        ljit_emit(a, 3, 0x48, 0x8b, 0x87);         // mov rax, [rdi + 8i]
+        ljit_emit32(a, 8 * i);
+        ljit_emit(a, 3, 0x48, 0x89, 0x85);         // mov [rbp - 8(i+1)], rax
+        ljit_emit32(a, -8 * (i + 1));
+    }
+    a->start = a->count;
+
+    if (ljit_call_expr(a, f->body, 1) != ret) return 0;
+    ljit_emit(a, 2, 0xc9, 0xc3);                   // leave; ret
+    return 1;
+}
+
+// The parameter list a lambda was made with. A partial application
+// keeps the ones it has bound in its frame, in order
+struct lval* lval_params(struct lval* f) {
+    if (f->env->count == 0) return lval_copy(f->args);
+    struct lval* x = lval_qexp();
+    lval_cells_hint(x, f->env->count + f->args->count);
+    for (int i = 0; i < f->env->count; i++) {
+        lval_add(x, lval_sym(f->env->syms[i]));
+    }
+    for (int i = 0; i < f->args->count; i++) {
+        lval_add(x, lval_copy(f->args->cell[i]));
+    }
+    return x;
+}
+
+// Compiles the lambda f, or the one it is a partial application of,
+// as they share their body and native code
+int ljit_compile(struct ljit* jit, struct lval* f) {
+    for (int i = 0; i < f->args->count; i++) {
+        if (f->args->cell[i]->sym == lsym_amp) return 0;
+    }
+
+    struct lval* params = lval_params(f);
+    struct ljit_asm a = { NULL, 0, 0, 0, 0, 0, jit, params, LVAL_NUM };
+    int ok = ljit_assemble(&a, f, LVAL_NUM)
+        || ljit_assemble(&a, f, LVAL_BOOL);
+
+    if (ok) {
+        size_t page = 4096;
+        jit->size = (a.count + page - 1) / page * page;
+        jit->mem = mmap(NULL, jit->size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (jit->mem == MAP_FAILED) {
+            jit->mem = NULL;
+            ok = 0;
+        } else {
+            memcpy(jit->mem, a.code, a.count);
+            mprotect(jit->mem, jit->size, PROT_READ | PROT_EXEC);
+            jit->fn = (long (*)(long*)) jit->mem;
+            jit->nparams = params->count;
+            jit->ret = a.ret;
+        }
+    }
+    lmem_free(a.code, a.cap);
+    lval_del(params);
+    return ok;
+}
+
+#else
+
+int ljit_compile(struct ljit* jit, struct lval* f) {
+    return 0;
+}
+
+#endif
+
+// Lets native code run again once the ltail_run at depth, which reruns
+// the calls that bailed while it was active, is done. Runs nest, so the
+// most recent reruns are the deepest
+void ljit_end_reruns(int depth) {
+    while (ljit_reruns && ljit_reruns->rerun >= depth) {
+        struct ljit* jit = ljit_reruns;
+        ljit_reruns = jit->next_rerun;
+        jit->rerun = 0;
+        jit->next_rerun = NULL;
+        ljit_del(jit);
+    }
+}
+
+// Runs f natively if it has been compiled and its guards pass. Consumes
+// args and returns the result, or returns NULL to have f interpreted
+struct lval* ljit_call(struct lval* f, struct lval* args) {
+    struct ljit* jit = f->jit;
+
+    if (jit->state == LJIT_COLD && ++jit->calls >= LJIT_THRESHOLD) {
+        if (ljit_compile(jit, f)) {
+            jit->state = LJIT_NATIVE;
+            ljit_stats.compiled++;
+        } else {
+            jit->state = LJIT_FAILED;
+            ljit_stats.failed++;
+        }
+    }
+    if (jit->state != LJIT_NATIVE || jit->rerun) return NULL;
+
+    // A partial application passes what it has bound first
+    int bound = f->env->count;
+    if (bound + args->count != jit->nparams) return NULL;
+    long vals[jit->nparams + 1];
+    for (int i = 0; i < bound; i++) {
+        if (f->env->vals[i]->type != LVAL_NUM) return NULL;
+        vals[i] = f->env->vals[i]->num;
+    }
+    for (int i = 0; i < args->count; i++) {
+        if (args->cell[i]->type != LVAL_NUM) return NULL;
+        vals[bound + i] = args->cell[i]->num;
+    }
+    for (int i = 0; i < jit->nsyms; i++) {
+        if (lsyms.locals[jit->syms[i]]) return NULL;
+        if (jit->targets[i] == 0) continue;
+        int slot = lenv_slot(lenv_globals, jit->syms[i]);
+        struct lval* g = lenv_globals->vals[slot];
+        if (lenv_globals->syms[slot] != jit->syms[i] || g->type != LVAL_FUN
+                || g->fun_type != LVAL_FUN_LAMBDA || g->jit == NULL
+                || g->jit->id != jit->targets[i]) {
+            return NULL;
+        }
+    }
+
+    ljit_bail = 0;
+    long x = jit->fn(vals);
+    if (ljit_bail) {
+        ljit_stats.bailouts++;
+        // Called outside any ltail_run, the rerun is in the next one
+        jit->rerun = ltail_depth ? ltail_depth : 1;
+        jit->next_rerun = ljit_reruns;
+        ljit_reruns = ljit_copy(jit);
+        return NULL;
+    }
+    ljit_stats.calls++;
+    lval_del(args);
+    return jit->ret == LVAL_NUM ? lval_num(x) : lval_bool(x);
+}
+
+// Ahead-of-time compiler. glenisp --emit-c lib.glenisp evaluates the
+// library once, then writes a C translation unit for it to stdout. Its
+// glenisp_load rebuilds each top-level expression directly, without
+// the parser, and evaluates it. Functions whose bodies fit the same
+// fixnum subset the JIT handles become C functions making direct
+// calls to each other. Tail calls to self become loops, and a body
+// that tail calls another function is left to the interpreter, since
+// C doesn't promise to run those in constant space. Once loaded they
+// are attached to their lambdas as native code, behind the JIT's
+// guards, so any call the code can't handle is still interpreted. They
+// bail through ljit_bail and are run by ljit_call, so a call that bails
+// stays interpreted for the rest of its rerun, as JIT code does.
+//
+// The unit builds as a shared object for glenisp --load=lib.so, or can
+// be linked into glenisp itself, which then loads it at startup.
+
+struct lval* laot_sym(char* name) {
+    return lval_sym(lsym_intern(name));
+}
+
+struct lval* laot_list(int quoted, int count, ...) {
+    struct lval* x = quoted ? lval_qexp() : lval_sexp();
+    va_list cells;
+    va_start(cells, count);
+    for (int i = 0; i < count; i++) {
+        lval_add(x, va_arg(cells, struct lval*));
+    }
+    va_end(cells);
+    return x;
+}
+
+// Evaluates a loaded expression, reporting whether it failed
+int laot_run(struct lenv* e, struct lval* x) {
+    struct lval* r = lval_eval(e, lfold_expr(x));
+    int failed = r->type == LVAL_ERR;
+    if (failed) {
+        printf("Error loading library: %s\n", r->err);
+    }
+    lval_del(r);
+    return failed;
+}
+
+// The lambda a global names, or NULL
+struct lval* laot_lambda(struct lenv* e, char* name) {
+    int sym = lsym_intern(name);
+    int slot = lenv_slot(e, sym);
+    if (e->syms[slot] != sym) return NULL;
+    struct lval* f = e->vals[slot];
+    if (f->type != LVAL_FUN || f->fun_type != LVAL_FUN_LAMBDA) return NULL;
+    return f;
+}
+
+// Gives the lambda bound to name native code, provided it is still the
+// function the code was compiled from
+void laot_attach(struct lenv* e, char* name, long (*fn)(long* args),
+        int nparams, int ret_bool, struct lval* body) {
+    struct lval* f = laot_lambda(e, name);
+    if (f && f->args->count == nparams && f->env->count == 0
+            && lval_equal(f->body, body)) {
+        if (f->jit == NULL) f->jit = ljit_new();
+        f->jit->state = LJIT_NATIVE;
+        f->jit->fn = fn;
+        f->jit->nparams = nparams;
+        f->jit->ret = ret_bool ? LVAL_BOOL : LVAL_NUM;
+        f->jit->nsyms = 0;
+    }
+    lval_del(body);
+}
+
+// Records a name the native code of name relies on. When target is set
+// the code calls the compiled function bound to it directly
+void laot_guard(struct lenv* e, char* name, char* sym, char* target) {
+    struct lval* f = laot_lambda(e, name);
+    if (f == NULL || f->jit == NULL || f->jit->state != LJIT_NATIVE) return;
+
+    long id = 0;
+    if (target) {
+        struct lval* g = laot_lambda(e, target);
+        if (g == NULL || g->jit == NULL || g->jit->state != LJIT_NATIVE) {
+            f->jit->state = LJIT_FAILED;
+            return;
+        }
+        id = g->jit->id;
+    }
+    if (!ljit_note_sym(f->jit, lsym_intern(sym), id)) {
+        f->jit->state = LJIT_FAILED;
+    }
+}
+
+struct laot_buf {
+    char* s;
+    int count;
+    int cap;
+};
+
+void laot_printf(struct laot_buf* b, char* fmt, ...) {
+    va_list va;
+    va_start(va, fmt);
+    int n = vsnprintf(NULL, 0, fmt, va);
+    va_end(va);
+    if (b->count + n + 1 > b->cap) {
+        int cap = b->cap ? b->cap * 2 : 1024;
+        while (cap < b->count + n + 1) cap *= 2;
+        b->s = realloc(b->s, cap);
+        b->cap = cap;
+    }
+    va_start(va, fmt);
+    vsnprintf(b->s + b->count, n + 1, fmt, va);
+    va_end(va);
+    b->count += n;
+}
+
+// The names a function's native code relies on
+struct laot_guards {
+    int nsyms;
+    int syms[LJIT_MAX_SYMS];
+    int calls[LJIT_MAX_SYMS]; // function each name calls, or -1
+};
+
+// A function the compiler found in the library
+struct laot_fun {
+    int sym;
+    struct lval* f;
+    int ok;
+    int known; // whether ret has been worked out
+    enum lval_type ret;
+    struct laot_guards guards; // including those of everything it calls
+};
+
+struct laot {
+    struct laot_buf code;
+    int indent;
+    int temps;
+    int loops; // whether the body jumps back to start
+    struct laot_fun* funs;
+    int nfuns;
+    int fun;
+    enum lval_type ret;
+    struct laot_guards guards;
+};
+
+void laot_line(struct laot* c, char* fmt, ...) {
+    char line[256];
+    va_list va;
+    va_start(va, fmt);
+    vsnprintf(line, sizeof(line), fmt, va);
+    va_end(va);
+    laot_printf(&c->code, "%*s%s\n", 4 * c->indent, "", line);
+}
+
+int laot_note_sym(struct laot_guards* g, int sym, int call) {
+    for (int i = 0; i < g->nsyms; i++) {
+        if (g->syms[i] == sym) return g->calls[i] == call;
+    }
+    if (g->nsyms == LJIT_MAX_SYMS) return 0;
+    g->syms[g->nsyms] = sym;
+    g->calls[g->nsyms++] = call;
+    return 1;
+}
+
+int laot_param(struct laot* c, int sym) {
+    struct lval* params = c->funs[c->fun].f->args;
+    for (int i = params->count - 1; i >= 0; i--) {
+        if (params->cell[i]->sym == sym) return i;
+    }
+    return -1;
+}
+
+enum lval_type laot_call(struct laot* c, struct lval* v, int tail, int* t);
+
+// Emits code computing v into temp *t, or returning it when in tail
+// position. Returns v's type, or LVAL_ERR when v can't be compiled
+enum lval_type laot_expr(struct laot* c, struct lval* v, int tail, int* t) {
+    enum lval_type type;
+    switch (v->type) {
+        case LVAL_NUM:
+            *t = c->temps++;
+            if (v->num == LONG_MIN) {
+                laot_line(c, "t%i = -%ldL - 1;", *t, LONG_MAX);
+            } else {
+                laot_line(c, "t%i = %ldL;", *t, v->num);
+            }
+            type = LVAL_NUM;
+            break;
+        case LVAL_BOOL:
+            *t = c->temps++;
+            laot_line(c, "t%i = %i;", *t, v->flag);
+            type = LVAL_BOOL;
+            break;
+        case LVAL_SYM: {
+            int i = laot_param(c, v->sym);
+            if (i < 0) return LVAL_ERR;
+            *t = c->temps++;
+            laot_line(c, "t%i = p%i;", *t, i);
+            type = LVAL_NUM;
+            break;
+        }
+        case LVAL_SEXP:
+            return laot_call(c, v, tail, t);
+        default:
+            return LVAL_ERR;
+    }
+    if (tail) laot_line(c, "return t%i;", *t);
+    return type;
+}
+
+enum lval_type laot_call(struct laot* c, struct lval* v, int tail, int* t) {
+    if (v->count == 0 || v->cell[0]->type != LVAL_SYM) return LVAL_ERR;
+
+    int sym = v->cell[0]->sym;
+    int argc = v->count - 1;
+    if (laot_param(c, sym) >= 0) return LVAL_ERR;
+    int slot = lenv_slot(lenv_globals, sym);
+    if (lenv_globals->syms[slot] != sym) return LVAL_ERR;
+    struct lval* f = lenv_globals->vals[slot];
+    if (f->type != LVAL_FUN) return LVAL_ERR;
+
+    int args[argc + 1];
+
+    if (f->fun_type == LVAL_FUN_LAMBDA) {
+        int j = 0;
+        while (j < c->nfuns && c->funs[j].f != f) j++;
+        if (j == c->nfuns || !c->funs[j].ok) return LVAL_ERR;
+        if (argc != c->funs[j].f->args->count) return LVAL_ERR;
+        if (!laot_note_sym(&c->guards, sym, j)) return LVAL_ERR;
+
+        for (int i = 0; i < argc; i++) {
+            if (laot_expr(c, v->cell[i + 1], 0, &args[i]) != LVAL_NUM) {
+                return LVAL_ERR;
+            }
+        }
+        if (tail && j == c->fun) {
+            for (int i = 0; i < argc; i++) {
+                laot_line(c, "p%i = t%i;", i, args[i]);
+            }
+            laot_line(c, "goto start;");
+            c->loops = 1;
+            return c->ret;
+        }
+
+        // A C compiler need not turn a tail call into a jump, so mutual
+        // recursion would use up the stack. Those stay with the
+        // interpreter, whose trampoline runs them in constant space
+        if (tail) return LVAL_ERR;
+
+        *t = c->temps++;
+        laot_printf(&c->code, "%*st%i = glc_%i(", 4 * c->indent, "", *t, j);
+        for (int i = 0; i < argc; i++) {
+            laot_printf(&c->code, "%st%i", i ? ", " : "", args[i]);
+        }
+        laot_printf(&c->code, ");\n");
+        laot_line(c, "if (ljit_bail) return 0;");
+        // Until a callee's type is settled, assume it matches ours
+        return j == c->fun || !c->funs[j].known ? c->ret : c->funs[j].ret;
+    }
+
+    lfunc fn = f->builtin;
+    if (!laot_note_sym(&c->guards, sym, -1)) return LVAL_ERR;
+
+    if (fn == lval_builtin_id) {
+        if (argc != 1) return LVAL_ERR;
+        return laot_expr(c, v->cell[1], tail, t);
+    }
+
+    if (fn == lval_builtin_if) {
+        if (argc != 3 || v->cell[2]->type != LVAL_QEXP
+                || v->cell[3]->type != LVAL_QEXP) {
+            return LVAL_ERR;
+        }
+        int cond, branch;
+        if (laot_expr(c, v->cell[1], 0, &cond) != LVAL_BOOL) return LVAL_ERR;
+        if (!tail) *t = c->temps++;
+        laot_line(c, "if (t%i) {", cond);
+        c->indent++;
+        enum lval_type type = laot_call(c, v->cell[2], tail, &branch);
+        if (!tail) laot_line(c, "t%i = t%i;", *t, branch);
+        c->indent--;
+        laot_line(c, "} else {");
+        c->indent++;
+        if (type == LVAL_ERR
+                || laot_call(c, v->cell[3], tail, &branch) != type) {
+            return LVAL_ERR;
+        }
+        if (!tail) laot_line(c, "t%i = t%i;", *t, branch);
+        c->indent--;
+        laot_line(c, "}");
+        return type;
+    }
+
+    char* cmp = NULL;
+    if (fn == lval_builtin_lt) cmp = "<";
+    if (fn == lval_builtin_lte) cmp = "<=";
+    if (fn == lval_builtin_gt) cmp = ">";
+    if (fn == lval_builtin_gte) cmp = ">=";
+    if (fn == lval_builtin_eq) cmp = "==";
+    if (fn == lval_builtin_neq) cmp = "!=";
+
+    char* op = NULL;
+    if (fn == lval_builtin_add) op = "+";
+    if (fn == lval_builtin_sub) op = "-";
+    if (fn == lval_builtin_mul) op = "*";
+    if (fn == lval_builtin_div) op = "/";
+    if (fn == lval_builtin_mod) op = "%";
+    if (fn == lval_builtin_min) op = "<";
+    if (fn == lval_builtin_max) op = ">";
+
+    if (fn == lval_builtin_not) {
+        if (argc != 1) return LVAL_ERR;
+    } else if (cmp) {
+        if (argc != 2) return LVAL_ERR;
+    } else if (op == NULL || argc == 0) {
+        return LVAL_ERR;
+    }
+
+    enum lval_type want = fn == lval_builtin_not ? LVAL_BOOL : LVAL_NUM;
+    for (int i = 0; i < argc; i++) {
+        if (laot_expr(c, v->cell[i + 1], 0, &args[i]) != want) {
+            return LVAL_ERR;
+        }
+    }
+
+    int x = *t = c->temps++;
+    if (fn == lval_builtin_not) {
+        laot_line(c, "t%i = !t%i;", x, args[0]);
+    } else if (cmp) {
+        laot_line(c, "t%i = t%i %s t%i;", x, args[0], cmp, args[1]);
+    } else if (argc == 1 && fn == lval_builtin_sub) {
+        laot_line(c, "if (__builtin_sub_overflow(0L, t%i, &t%i)) "
+            "{ ljit_bail = 1; return 0; }", args[0], x);
+    } else {
+        laot_line(c, "t%i = t%i;", x, args[0]);
+    }
+
+    // Overflow bails, and the interpreter redoes the call with bignums
+    for (int i = 1; op && i < argc; i++) {
+        int y = args[i];
+        if (fn == lval_builtin_min || fn == lval_builtin_max) {
+            laot_line(c, "if (t%i %s t%i) t%i = t%i;", y, op, x, x, y);
+        } else if (fn == lval_builtin_div || fn == lval_builtin_mod) {
+            // x / -1 traps on LONG_MIN, so negate instead
+            laot_line(c, "if (t%i == 0) { ljit_bail = 1; return 0; }", y);
+            if (fn == lval_builtin_div) {
+                laot_line(c, "if (t%i == -1 ? __builtin_sub_overflow(0L, "
+                    "t%i, &t%i) : (t%i /= t%i, 0)) "
+                    "{ ljit_bail = 1; return 0; }", y, x, x, x, y);
+            } else {
+                laot_line(c, "t%i = t%i == -1 ? 0 : t%i %% t%i;", x, y, x, y);
+            }
+        } else {
+            char* builtin = fn == lval_builtin_add ? "add"
+                : fn == lval_builtin_sub ? "sub" : "mul";
+            laot_line(c, "if (__builtin_%s_overflow(t%i, t%i, &t%i)) "
+                "{ ljit_bail = 1; return 0; }", builtin, x, y, x);
+        }
+    }
+
+    if (tail) laot_line(c, "return t%i;", x);
+    return cmp || fn == lval_builtin_not ? LVAL_BOOL : LVAL_NUM;
+}
+
+// Compiles function i into c->code as returning ret, and gives back the
+// type it really returns, or LVAL_ERR
+enum lval_type laot_function(struct laot* c, int i, enum lval_type ret) {
+    c->code.count = 0;
+    c->indent = 1;
+    c->temps = 0;
+    c->loops = 0;
+    c->fun = i;
+    c->ret = ret;
+    c->guards.nsyms = 0;
+    int t;
+    return laot_call(c, c->funs[i].f->body, 1, &t);
+}
+
+int laot_compile(struct laot* c, int i) {
+    enum lval_type ret = LVAL_NUM;
+    if (laot_function(c, i, ret) != ret) {
+        ret = LVAL_BOOL;
+        if (laot_function(c, i, ret) != ret) return 0;
+    }
+    c->funs[i].ret = ret;
+    c->funs[i].known = 1;
+    return 1;
+}
+
+// Compiled functions call each other directly, so a caller's code also
+// relies on every name its callees rely on. Given (fun {g x} {* x 2})
+// and (fun {f x} {+ (g x) 1}), rebinding * must stop f running natively
+// too. Adds callees' guards to their callers until nothing changes, and
+// returns 0 if that overflows some function's guards, which then stops
+// compiling
+int laot_close_guards(struct laot* c) {
+    for (int i = 0; i < c->nfuns; i++) {
+        if (!c->funs[i].ok) continue;
+        laot_function(c, i, c->funs[i].ret);
+        c->funs[i].guards = c->guards;
+    }
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (int i = 0; i < c->nfuns; i++) {
+            if (!c->funs[i].ok) continue;
+            struct laot_guards* g = &c->funs[i].guards;
+            for (int k = 0; k < g->nsyms; k++) {
+                int j = g->calls[k];
+                if (j < 0 || j == i) continue;
+                struct laot_guards* h = &c->funs[j].guards;
+                for (int m = 0; m < h->nsyms; m++) {
+                    int n = g->nsyms;
+                    if (!laot_note_sym(g, h->syms[m], h->calls[m])) {
+                        c->funs[i].ok = 0;
+                        return 0;
+                    }
+                    if (g->nsyms != n) changed = 1;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+void laot_params(struct laot* c, int i, FILE* out) {
+    int n = c->funs[i].f->args->count;
+    if (n == 0) fprintf(out, "void");
+    for (int p = 0; p < n; p++) fprintf(out, "%slong p%i", p ? ", " : "", p);
+}
+
+void laot_string(struct laot_buf* b, char* s) {
+    laot_printf(b, "\"");
+    for (; *s; s++) {
+        // escape ? too, so no trigraphs
+        if (*s == '\\' || *s == '"' || *s == '?') laot_printf(b, "\\");
+        laot_printf(b, "%c", *s);
+    }
+    laot_printf(b, "\"");
+}
+
+// Writes a C expression that rebuilds v
+void laot_build(struct laot_buf* b, struct lval* v) {
+    switch (v->type) {
+        case LVAL_NUM:
+            if (v->num == LONG_MIN) {
+                laot_printf(b, "lval_num(-%ldL - 1)", LONG_MAX);
+            } else {
+                laot_printf(b, "lval_num(%ldL)", v->num);
+            }
+            break;
+        case LVAL_BIG: {
+            char* s = lbig_string(v);
+            laot_printf(b, "lval_read_num(\"%s\")", s);
+            free(s);
+            break;
+        }
+        case LVAL_BOOL:
+            laot_printf(b, "lval_bool(%i)", v->flag);
+            break;
+        case LVAL_SYM:
+            laot_printf(b, "laot_sym(");
+            laot_string(b, lsym_name(v->sym));
+            laot_printf(b, ")");
+            break;
+        case LVAL_SEXP:
+        case LVAL_QEXP:
+            laot_printf(b, "laot_list(%i, %i",
+                v->type == LVAL_QEXP, v->count);
+            for (int i = 0; i < v->count; i++) {
+                laot_printf(b, ", ");
+                laot_build(b, v->cell[i]);
+            }
+            laot_printf(b, ")");
+            break;
+        default:
+            // only literals can be written back out
+            laot_printf(b, "laot_sym(\"\")");
+            break;
+    }
+}
+
+int laot_emit(struct lenv* e, struct lval* exprs, char* source, FILE* out) {
+    // Run the library, noting which globals were already bound
+    int known = lsyms.count;
+    char* bound = calloc(known + 1, 1);
+    for (int i = 0; i < e->cap; i++) {
+        if (e->syms[i] >= 0) bound[e->syms[i]] = 1;
+    }
+    for (int i = 0; i < exprs->count; i++) {
+        struct lval* r = lval_eval(e, lfold_expr(lval_copy(exprs->cell[i])));
+        if (r->type == LVAL_ERR) {
+            fprintf(stderr, "%s: expression %i: %s\n", source, i + 1, r->err);
+        }
+        lval_del(r);
+    }
+
+    // Every lambda it defined is a candidate for compiling
+    struct laot c;
+    memset(&c, 0, sizeof(c));
+    c.funs = malloc(sizeof(struct laot_fun) * (e->count + 1));
+    for (int i = 0; i < e->cap; i++) {
+        int sym = e->syms[i];
+        if (sym < 0 || (sym < known && bound[sym])) continue;
+        struct lval* f = e->vals[i];
+        if (f->type != LVAL_FUN || f->fun_type != LVAL_FUN_LAMBDA) continue;
+        if (f->env->count) continue;
+        int fixed = 1;
+        for (int j = 0; j < f->args->count; j++) {
+            if (f->args->cell[j]->sym == lsym_amp) fixed = 0;
+        }
+        if (!fixed) continue;
+        struct laot_fun fun = { sym, f, 1, 0, LVAL_NUM };
+        c.funs[c.nfuns++] = fun;
+    }
+    free(bound);
+
+    // Whether a function compiles depends on the ones it calls, so
+    // settle which do, what they return and what they rely on before
+    // writing anything
+    do {
+        int rounds = 0;
+        for (int changed = 1; changed; rounds++) {
+            changed = 0;
+            for (int i = 0; i < c.nfuns; i++) {
+                if (!c.funs[i].ok) continue;
+                enum lval_type ret = c.funs[i].ret;
+                int known = c.funs[i].known;
+                if (rounds > c.nfuns + 2 || !laot_compile(&c, i)) {
+                    c.funs[i].ok = 0;
+                    changed = 1;
+                } else if (!known || c.funs[i].ret != ret) {
+                    changed = 1;
+                }
+            }
+        }
+    } while (!laot_close_guards(&c));
+
+    fprintf(out, "// Generated by glenisp --emit-c from %s\n\n", source);
+    fprintf(out,
+        "struct lval;\n"
+        "struct lenv;\n\n"
+        "extern char ljit_bail;\n"
+        "struct lval* lval_num(long x);\n"
+        "struct lval* lval_bool(int flag);\n"
+        "struct lval* lval_read_num(char* value);\n"
+        "struct lval* laot_sym(char* name);\n"
+        "struct lval* laot_list(int quoted, int count, ...);\n"
+        "int laot_run(struct lenv* e, struct lval* x);\n"
+        "void laot_attach(struct lenv* e, char* name, "
+        "long (*fn)(long* args),\n"
+        "    int nparams, int ret_bool, struct lval* body);\n"
+        "void laot_guard(struct lenv* e, char* name, char* sym, "
+        "char* target);\n\n");
+
+    for (int i = 0; i < c.nfuns; i++) {
+        if (!c.funs[i].ok) continue;
+        fprintf(out, "static long glc_%i(", i);
+        laot_params(&c, i, out);
+        fprintf(out, ");\n");
+    }
+
+    for (int i = 0; i < c.nfuns; i++) {
+        if (!c.funs[i].ok) continue;
+        laot_function(&c, i, c.funs[i].ret);
+        fprintf(out, "\n// %s\nstatic long glc_%i(",
+            lsym_name(c.funs[i].sym), i);
+        laot_params(&c, i, out);
+        fprintf(out, ") {\n");
+        if (c.temps) {
+            fprintf(out, "    long t0");
+            for (int t = 1; t < c.temps; t++) fprintf(out, ", t%i", t);
+            fprintf(out, ";\n");
+        }
+        if (c.loops) fprintf(out, "start:\n");
+        fwrite(c.code.s, 1, c.code.count, out);
+        fprintf(out, "}\n");
+
+        // The runtime passes arguments as an array
+        int n = c.funs[i].f->args->count;
+        fprintf(out, "\nstatic long glc_%i_entry(long* a) {\n", i);
+        fprintf(out, "    return glc_%i(", i);
+        for (int p = 0; p < n; p++) fprintf(out, "%sa[%i]", p ? ", " : "", p);
+        fprintf(out, ");\n}\n");
+    }
+
+    struct laot_buf b = { NULL, 0, 0 };
+    laot_printf(&b, "\nint glenisp_load(struct lenv* e) {\n");
+    laot_printf(&b, "    int failed = 0;\n");
+    for (int i = 0; i < exprs->count; i++) {
+        laot_printf(&b, "    failed += laot_run(e, ");
+        laot_build(&b, exprs->cell[i]);
+        laot_printf(&b, ");\n");
+    }
+    for (int i = 0; i < c.nfuns; i++) {
+        if (!c.funs[i].ok) continue;
+        laot_printf(&b, "    laot_attach(e, ");
+        laot_string(&b, lsym_name(c.funs[i].sym));
+        laot_printf(&b, ", glc_%i_entry, %i, %i,\n        ", i,
+            c.funs[i].f->args->count, c.funs[i].ret == LVAL_BOOL);
+        laot_build(&b, c.funs[i].f->body);
+        laot_printf(&b, ");\n");
+    }
+    for (int i = 0; i < c.nfuns; i++) {
+        if (!c.funs[i].ok) continue;
+        struct laot_guards* g = &c.funs[i].guards;
+        for (int j = 0; j < g->nsyms; j++) {
+            laot_printf(&b, "    laot_guard(e, ");
+            laot_string(&b, lsym_name(c.funs[i].sym));
+            laot_printf(&b, ", ");
+            laot_string(&b, lsym_name(g->syms[j]));
+            if (g->calls[j] >= 0) {
+                laot_printf(&b, ", ");
+                laot_string(&b, lsym_name(c.funs[g->calls[j]].sym));
+                laot_printf(&b, ");\n");
+            } else {
+                laot_printf(&b, ", 0);\n");
+            }
+        }
+    }
+    laot_printf(&b, "    return failed;\n}\n");
+    fwrite(b.s, 1, b.count, out);
+
+    int compiled = 0;
+    for (int i = 0; i < c.nfuns; i++) compiled += c.funs[i].ok;
+    fprintf(stderr, "%s: %i of %i functions compiled to C\n",
+        source, compiled, c.nfuns);
+
+    free(b.s);
+    free(c.code.s);
+    free(c.funs);
+    return 0;
+}
+
+// The whole of a source file, or NULL
+char* laot_source(char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* src = malloc(size + 1);
+    size = fread(src, 1, size, f);
+    src[size] = '\0';
+    fclose(f);
+    return src;
+}
+
+// Loads a library compiled with --emit-c and built as a shared object.
+// glenisp must be linked with -rdynamic for it to find the runtime
+int laot_load(struct lenv* e, char* path) {
+#ifdef __unix__
+    void* lib = dlopen(path, RTLD_NOW);
+    if (lib == NULL) {
+        printf("Error: %s\n", dlerror());
+        return 1;
+    }
+    int (*load)(struct lenv*) =
+        (int (*)(struct lenv*)) dlsym(lib, "glenisp_load");
+    if (load == NULL) {
+        printf("Error: %s has no glenisp_load\n", path);
+        return 1;
+    }
+    return load(e);
+#else
+    printf("Error: can't load %s on this platform\n", path);
+    return 1;
+#endif
+}
+
+// A library compiled with --emit-c and linked in statically
+#ifdef __GNUC__
+int glenisp_load(struct lenv* e) __attribute__((weak));
+#endif
+
+// A lambda for frame with the given parameters, sharing f's body and
+// code. Consumes f
+struct lval* lval_frame_fun(struct lval* f, struct lenv* frame,
+        struct lval* params) {
+    struct lval* x = lval_new(LVAL_FUN);
+    x->fun_type = LVAL_FUN_LAMBDA;
+    x->serial = 0;
+    x->env = frame;
+    x->args = params;
+    x->body = lval_copy(f->body);
+    x->folded = f->folded ? lval_copy(f->folded) : NULL;
+    x->code = f->code ? lcode_copy(f->code) : NULL;
+    x->jit = f->jit ? ljit_copy(f->jit) : NULL;
+    lval_del(f);
+    return x;
+}
+
+// Runs x, a lambda whose frame is complete, called from e. The body
+// runs in the caller's ltail_run, which takes over x. A folded body,
+// and any bytecode, which is compiled from it, only run while no frame
+// shadows a builtin some folded body relies on
+struct lval* lval_frame_run(struct lenv* e, struct lval* x) {
+    x->env->parent = e;
+    if (x->folded && lfold_shadowed) {
+        return ltail_call(x->env, lval_copy(x->body), x);
+    }
+    struct lval* body = x->folded ? x->folded : x->body;
+    return ltail_call(x->env, x->code ? NULL : lval_copy(body), x);
+}
+
+struct lval* lval_eval_call(struct lenv* e, struct lval* f, struct lval* args) {
+    if (f->fun_type == LVAL_FUN_BUILTIN) {
+        LGC_PUSH(f);
+        struct lval* result = f->builtin(e, args);
+        LGC_POP();
+        lval_del(f);
+        return result;
+    }
+
+    if (f->jit) {
+        struct lval* result = ljit_call(f, args);
+        if (result) {
+            lval_del(f);
+            return result;
+        }
+    }
+
+    // Parameters up to any & take one argument each
+    struct lval* params = f->args;
+    int given = args->count;
+    int total = params->count;
+    int fixed = total;
+    for (int i = 0; i < total; i++) {
+        if (params->cell[i]->sym == lsym_amp) {
+            fixed = i;
+            break;
+        }
+    }
+    int varargs = fixed < total;
+
+    if (given > fixed && !varargs) {
+        lval_del(args);
+        lval_del(f);
+        return lval_err(
+            "Too many arguments. Got %i, expected %i.",
+            given, total
+        );
+    }
+
+    int complete = given >= fixed;
+    if (given == 0 && !complete) {
+        lval_del(args);
+        return f;
+    }
+
+    // The call gets one new frame, holding what earlier partial
+    // applications bound and then this call's arguments by index
+    int bound = f->env->count;
+    int n = complete ? fixed + varargs : given;
+    struct lenv* frame = lenv_frame(bound + n);
+    for (int i = 0; i < bound; i++) {
+        frame->syms[i] = f->env->syms[i];
+        frame->vals[i] = lval_copy(f->env->vals[i]);
+    }
+    for (int i = 0; i < n && i < fixed; i++) {
+        frame->syms[bound + i] = params->cell[i]->sym;
+        frame->vals[bound + i] = lval_copy(args->cell[i]);
+    }
+    if (complete && varargs) {
+        // The rest of the arguments, viewed in place
+        struct lval* rest = lval_slice(args, fixed, given - fixed);
+        rest->type = LVAL_QEXP;
+        frame->syms[bound + fixed] = params->cell[fixed + 1]->sym;
+        frame->vals[bound + fixed] = rest;
+    } else {
+        lval_del(args);
+    }
+    lenv_count_locals(frame, 1);
+
+    // When partial, the parameters are those still to come
+    if (!complete) {
+        return lval_frame_fun(f, frame,
+            lval_slice(lval_copy(params), given, total - given));
+    }
+    return lval_frame_run(e, lval_frame_fun(f, frame, lval_copy(params)));
+}
+
+// Special form: an sexp headed by the if builtin, by that name. It
+// evaluates its condition and then only the branch it takes, in tail
+// position. A branch that is not a qexp is evaluated, if taken, for the
+// qexp to run. Anything unusual falls back to the builtin, which reports
+// the error. An alias of if is an ordinary call, as the VM can only tell
+// forms apart before their head is evaluated (see lvm_is_form), and both
+// engines must evaluate the same operands
+int lval_is_form(struct lval* v, struct lval* f) {
+    return f->type == LVAL_FUN && f->fun_type == LVAL_FUN_BUILTIN
+        && f->builtin == lval_builtin_if
+        && v->cell[0]->type == LVAL_SYM && v->cell[0]->sym == lsym_if;
+}
+
+struct lval* lval_eval_form(struct lenv* e, struct lval* v, struct lval* f) {
+    struct lval* args = lval_sexp();
+    lval_cells_hint(args, v->count);
+    lval_add(args, f);
+    int i = 1;
+
+    LGC_PUSH(args);
+    if (f->builtin == lval_builtin_if && v->count == 4) {
+        lval_add(args, lval_eval_ref(e, v->cell[1]));
+        i = 2;
+
+        if (args->cell[1]->type == LVAL_BOOL) {
+            int taken = args->cell[1]->flag ? 2 : 3;
+            LGC_POP();
+            lval_del(args);
+            struct lval* branch = v->cell[taken];
+            if (branch->type == LVAL_QEXP) {
+                return ltail_call(e, lval_copy(branch), NULL);
+            }
+            branch = lval_eval_ref(e, branch);
+            if (branch->type == LVAL_QEXP) {
+                return ltail_call(e, branch, NULL);
+            }
+            if (branch->type == LVAL_ERR) {
+                return branch;
+            }
+            struct lval* err = lval_err(
+                "Wrong type for arg %i in 'if'. Got %s, expected %s",
+                taken - 1, lval_type_name(branch->type),
+                lval_type_name(LVAL_QEXP));
+            lval_del(branch);
+            return err;
+        }
+    }
+
+    for (; i < v->count; i++) {
+        struct lval* x = v->cell[i];
+        x = x->type == LVAL_QEXP ? lval_copy(x) : lval_eval_ref(e, x);
+        lval_add(args, x);
+    }
+    LGC_POP();
+
+    return lval_eval_apply(e, args);
+}
+
+// Self-specializing call sites. An sexp remembers what it has called,
+// the first time it runs, in its site state. A site that called an
+// arithmetic or comparison builtin with two operands, or a lambda taking
+// exactly its arguments, notes the op or the lambda's serial number and
+// from then on takes a fast path, guarded by the function being the same
+// one. It holds no reference, as a lambda's body is often among the
+// sites calling it: operands that are both fixnums are combined directly, and a
+// lambda's frame is filled straight from the evaluated arguments. Both
+// skip building an argument list. A guard that fails rewrites the site
+// to the generic path for good, as does any other first call.
+enum lsite { LSITE_UNINIT, LSITE_OP, LSITE_LAMBDA, LSITE_GENERIC };
+
+struct {
+    long ops;
+    long lambdas;
+    long generic;
+    long deopts;
+    long fast;
+} lsite_stats = { 0, 0, 0, 0, 0 };
+
+void lsite_print_stats(void) {
+    printf("specialize: %li op sites, %li lambda sites, %li generic, "
+        "%li deopts, %li fast calls\n", lsite_stats.ops,
+        lsite_stats.lambdas, lsite_stats.generic, lsite_stats.deopts,
+        lsite_stats.fast);
+}
+
+// The builtins of each enum lop, in order
+lfunc lsite_ops[LOP_COUNT] = {
+    lval_builtin_add, lval_builtin_sub, lval_builtin_mul, lval_builtin_div,
+    lval_builtin_mod, lval_builtin_pow, lval_builtin_min, lval_builtin_max,
+    lval_builtin_lt, lval_builtin_lte, lval_builtin_gt, lval_builtin_gte,
+    lval_builtin_eq, lval_builtin_neq
+};
+
+int lsite_op(struct lval* f) {
+    for (int op = 0; op < LOP_COUNT; op++) {
+        if (f->builtin == lsite_ops[op]) return op;
+    }
+    return -1;
+}
+
+void lsite_specialize(struct lval* v, struct lval* f) {
+    // Wait for a function, rather than an unbound name, say
+    if (f->type == LVAL_ERR) return;
+
+    v->site = LSITE_GENERIC;
+    if (f->type != LVAL_FUN) {
+        lsite_stats.generic++;
+        return;
+    }
+    if (f->fun_type == LVAL_FUN_BUILTIN) {
+        if (v->count == 3 && lsite_op(f) >= 0) v->site = LSITE_OP;
+    } else if (f->serial && f->args->count == v->count - 1
+            && f->jit == NULL) {
+        // Not ones the JIT might run instead
+        v->site = LSITE_LAMBDA;
+    }
+
+    switch (v->site) {
+        case LSITE_OP:
+            lsite_stats.ops++;
+            v->target = lsite_op(f);
+            break;
+        case LSITE_LAMBDA:
+            lsite_stats.lambdas++;
+            v->target = f->serial;
+            break;
+        default:
+            lsite_stats.generic++;
+            break;
+    }
+}
+
+// Whether f is the function site v was specialized on. Serial numbers
+// only repeat once they wrap, and any lambda passing this can take the
+// fast path anyway
+int lsite_guard(struct lval* v, struct lval* f) {
+    if (f->type != LVAL_FUN) return 0;
+    if (v->site == LSITE_OP) {
+        return f->fun_type == LVAL_FUN_BUILTIN && v->count == 3
+            && f->builtin == lsite_ops[v->target];
+    }
+    return f->fun_type == LVAL_FUN_LAMBDA && f->serial == v->target
+        && f->jit == NULL && v->count - 1 == f->args->count;
+}
+
+// Operands may run the same site recursively, so it may be generic
+// already
+void lsite_deopt(struct lval* v) {
+    if (v->site == LSITE_GENERIC) return;
+    v->site = LSITE_GENERIC;
+    v->target = 0;
+    lsite_stats.deopts++;
+}
+
+// The fast path for a two fixnum operator, or NULL to take the generic
+// path with the operands in x and y
+struct lval* lsite_eval_op(struct lenv* e, struct lval* v, struct lval* f,
+        struct lval** x, struct lval** y) {
+    *x = lval_eval_ref(e, v->cell[1]);
+    LGC_PUSH(*x);
+    *y = lval_eval_ref(e, v->cell[2]);
+    LGC_POP();
+    if ((*x)->type != LVAL_NUM || (*y)->type != LVAL_NUM) {
+        if ((*x)->type != LVAL_ERR && (*y)->type != LVAL_ERR) lsite_deopt(v);
+        return NULL;
+    }
+
+    int op = v->target;
+    long a = (*x)->num;
+    long b = (*y)->num;
+    struct lval* r;
+    switch (op) {
+        case LOP_LT: r = lval_bool(a < b); break;
+        case LOP_LTE: r = lval_bool(a <= b); break;
+        case LOP_GT: r = lval_bool(a > b); break;
+        case LOP_GTE: r = lval_bool(a >= b); break;
+        case LOP_EQ: r = lval_bool(a == b); break;
+        case LOP_NEQ: r = lval_bool(a != b); break;
+        default:
+            // overflow and division by 0 are left to the builtin
+            if (lop_arith_fns[op](&a, b) <= 0) return NULL;
+            r = lval_num(a);
+            break;
+    }
+    lsite_stats.fast++;
+    lval_del(*x);
+    lval_del(*y);
+    lval_del(f);
+    return r;
+}
+
+// The fast path for a call to the site's lambda, which consumes f
+struct lval* lsite_eval_lambda(struct lenv* e, struct lval* v,
+        struct lval* f) {
+    int n = v->count - 1;
+    LGC_PUSH(f);
+    for (int i = 1; i <= n; i++) {
+        LGC_PUSH(lval_eval_ref(e, v->cell[i]));
+    }
+    lgc_roots.count -= n + 1;
+    struct lval** vals = &lgc_roots.vals[lgc_roots.count + 1];
+
+    // An error stops the call, as in lval_eval_apply
+    for (int i = 0; i < n; i++) {
+        if (vals[i]->type != LVAL_ERR) continue;
+        struct lval* err = vals[i];
+        for (int j = 0; j < n; j++) {
+            if (j != i) lval_del(vals[j]);
+        }
+        lval_del(f);
+        return err;
+    }
+
+    struct lenv* frame = lenv_frame(n);
+    for (int i = 0; i < n; i++) {
+        frame->syms[i] = f->args->cell[i]->sym;
+        frame->vals[i] = vals[i];
+    }
+    lenv_count_locals(frame, 1);
+    lsite_stats.fast++;
+
+    return lval_frame_run(e, lval_frame_fun(f, frame, lval_copy(f->args)));
+}
+
+// The evaluator borrows the expression it is given: it only reads it
+// and allocates the values it produces, so lambda bodies and if branches
+// run in place however often they are called. Until it returns, the
+// caller keeps v alive and where the collector can find it.
+struct lval* lval_eval_sexp(struct lenv* e, struct lval* v) {
+    if (v->count == 0) return lval_sexp();
+
+    struct lval* f = lval_eval_ref(e, v->cell[0]);
+    if (lval_is_form(v, f)) return lval_eval_form(e, v, f);
+
+    if (v->site == LSITE_UNINIT) lsite_specialize(v, f);
+
+    struct lval* x = NULL;
+    struct lval* y = NULL;
+    if (v->site == LSITE_OP && lsite_guard(v, f)) {
+        struct lval* r = lsite_eval_op(e, v, f, &x, &y);
+        if (r) return r;
+    } else if (v->site == LSITE_LAMBDA && lsite_guard(v, f)) {
+        return lsite_eval_lambda(e, v, f);
+    } else if (v->site != LSITE_UNINIT) {
+        lsite_deopt(v);
+    }
+
+    struct lval* args = lval_sexp();
+    lval_cells_hint(args, v->count);
+    lval_add(args, f);
+    int i = 1;
+    if (x) {
+        // operands the fast path evaluated before giving up
+        lval_add(args, x);
+        lval_add(args, y);
+        i = 3;
+    }
+
+    LGC_PUSH(args);
+    for (; i < v->count; i++) {
+        lval_add(args, lval_eval_ref(e, v->cell[i]));
+    }
+    LGC_POP();
+
+    return lval_eval_apply(e, args);
+}
+
+// Applies an sexp whose cells have all been evaluated
+struct lval* lval_eval_apply(struct lenv* e, struct lval* v) {
+    for (int i = 0; i < v->count; i++) {
+        if (v->cell[i]->type == LVAL_ERR) {
+            return lval_take(v, i);
+        }
+    }
+
+    if (v->count == 0) return v;
+
+    struct lval* f = lval_pop(v, 0);
+    if (f->type != LVAL_FUN) {
+        struct lval* err = lval_err(
+            "Expected sexp to begin with %s, got %s",
+            lval_type_name(LVAL_FUN), lval_type_name(f->type));
+        lval_del(f);
+        lval_del(v);
+        return err;
+    }
+    return lval_eval_call(e, f, v);
+}
+
+struct lval* lval_eval_step(struct lenv* e, struct lval* v) {
+    if (v->type == LVAL_SYM) return lenv_get_sym(e, v);
+    if (v->type == LVAL_SEXP) return lval_eval_sexp(e, v);
+    return lval_copy(v);
+}
+
+struct lval* lval_eval_ref(struct lenv* e, struct lval* v) {
+    return ltail_run(lval_eval_step(e, v));
+}
+
+// Evaluates v and then deletes it
+struct lval* lval_eval(struct lenv* e, struct lval* v) {
+    LGC_PUSH(v);
+    struct lval* r = lval_eval_step(e, v);
+    LGC_POP();
+    lval_del(v);
+    return ltail_run(r);
+}
+
+int main(int argc, char** argv)
+{
+    mpc_parser_t* Bool = mpc_new("bool");
     mpc_parser_t* Number = mpc_new("number");
     mpc_parser_t* Symbol = mpc_new("symbol");
     mpc_parser_t* Sexp = mpc_new("sexp");
     mpc_parser_t* Qexp = mpc_new("qexp");
     mpc_parser_t* Expr = mpc_new("expr");
     mpc_parser_t* Program = mpc_new("program");
+    mpc_parser_t* File = mpc_new("file");
 
     mpca_lang(MPCA_LANG_DEFAULT,
     "                                                       \
@@ -975,15 +5093,75 @@ int main(int argc, char** argv)
         expr     : <bool> | <number> | <symbol> |           \
                    <sexp> | <qexp> ;                        \
         program  : /^/ <expr> /$/ ;                         \
+        file     : /^/ <expr>* /$/ ;                        \
     ",
-        Bool, Number, Symbol, Sexp, Qexp, Expr, Program);
+        Bool, Number, Symbol, Sexp, Qexp, Expr, Program, File);
+
+    long nursery = 4096;
+    int simd = 1;
+    char* emit = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--emit-c") == 0 && i + 1 < argc) {
+            emit = argv[++i];
+        }
+        if (strncmp(argv[i], "--nursery=", 10) == 0) {
+            nursery = strtol(argv[i] + 10, NULL, 10);
+        }
+        if (strcmp(argv[i], "--engine=vm") == 0) {
+            lvm_engine = LVM_ENGINE_VM;
+        }
+        if (strcmp(argv[i], "--engine=tree") == 0) {
+            lvm_engine = LVM_ENGINE_TREE;
+        }
+        if (strcmp(argv[i], "--jit=off") == 0) ljit_mode = LJIT_OFF;
+        if (strcmp(argv[i], "--jit=on") == 0) ljit_mode = LJIT_ON;
+        if (strcmp(argv[i], "--jit=stats") == 0) ljit_mode = LJIT_STATS;
+        if (strcmp(argv[i], "--simd=off") == 0) simd = 0;
+        if (strcmp(argv[i], "--specialize-stats") == 0) {
+            atexit(lsite_print_stats);
+        }
+    }
+    if (nursery < 1) nursery = 1;
+    if (ljit_mode == LJIT_STATS) atexit(ljit_print_stats);
+
+    lsym_amp = lsym_intern("&");
+    lsym_lambda = lsym_intern("\\");
+    lsym_if = lsym_intern("if");
+    lval_init_immediates();
+    lvec_init(simd);
+    lgc_init_nursery(nursery);
+
+    struct lenv* e = lenv_new_root();
+    lenv_add_builtins(e);
+
+    if (emit) {
+        char* src = laot_source(emit);
+        if (src == NULL) {
+            fprintf(stderr, "Can't read %s\n", emit);
+            return 1;
+        }
+        mpc_result_t r;
+        if (!mpc_parse(emit, src, File, &r)) {
+            mpc_err_print_to(r.error, stderr);
+            mpc_err_delete(r.error);
+            return 1;
+        }
+        struct lval* exprs = lval_read_file(r.output);
+        mpc_ast_delete(r.output);
+        free(src);
+        return laot_emit(e, exprs, emit, stdout);
+    }
 
     puts("Welcome to gLenISP Version 0.0.0.1");
     puts("You have 1000 parentheses remaining");
     puts("Press Ctrl+c to Exit\n");
 
-    struct lenv* e = lenv_new();
-    lenv_add_builtins(e);
+#ifdef __GNUC__
+    if (glenisp_load) glenisp_load(e);
+#endif
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--load=", 7) == 0) laot_load(e, argv[i] + 7);
+    }
 
     while (1) {
 
@@ -1006,6 +5184,8 @@ int main(int argc, char** argv)
             puts("Input:");
             lval_print(x); putchar('\n');
 
+            x = lfold_expr(x);
+
             struct lval* r = lval_eval(e, x);
 
             puts("Output:");
@@ -1013,6 +5193,8 @@ int main(int argc, char** argv)
 
             lval_del(r);
 
+            if (lgc_young.next == lgc_young.end) lgc_minor(e);
+
         } else {
             mpc_err_print(r.error);
             mpc_err_delete(r.error);
@@ -1022,7 +5204,7 @@ int main(int argc, char** argv)
 
     }
 
-    mpc_cleanup(6, Bool, Number, Symbol, Sexp, Qexp, Expr, Program);
+    mpc_cleanup(8, Bool, Number, Symbol, Sexp, Qexp, Expr, Program, File);
 
     return 0;
 }
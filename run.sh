@@ -1 +1 @@
-nodemon -w . -e "c h" -x 'sh -c' 'cc -std=c99 -Wall -Werror glenisp.c mpc.c -ledit -o glenisp && growlnotify -m OK || growlnotify -m FAIL'
+nodemon -w . -e "c h" -x 'sh -c' 'cc -std=c99 -Wall -Werror glenisp.c mpc.c -ledit -ldl -rdynamic -o glenisp && growlnotify -m OK || growlnotify -m FAIL'